@@ -0,0 +1,598 @@
+/* api_check - check the library's entry points against each other.
+
+To compile: g++ -O2 -std=c++17 -I. -I../ext/fpaq0f2 api_check.cpp ../ext/fpaq0f2/fpaq0f2.cpp -lpthread
+To run:     api_check [-n count] [-s seed]
+
+Codes the corpora of corpus.h and random inputs through each way the
+library has of coding a value, adaptively, with the default model and
+with one trained on the corpora, and checks that each writes the bytes
+of fpaq0f2_compress(), or of fpaq0f2_model_compress() with the model,
+and reads them back. Exits 1 on the first difference, as orig_compare
+does, so a change to the library can be gated on it.
+
+  streams   fpaq0f2_stream_*, fed and drained in chunks of random sizes
+  vectors   fpaq0f2_compressv() and the like, over random segments, empty
+            ones included
+  strings   compressed_string of fpaq0f2_string.hpp: str(), its bytes from
+            begin() to end(), and starts_with()
+  frames    fpaq0f2_frame_*, with and without a CRC, and the rejection of
+            a wrong model, a flipped byte and a truncated frame
+  fixed     fixed width values, alone and in batches of random widths,
+            each batch value as fpaq0f2_model_compress_fixed() codes it
+  queue     fpaq0f2_queue_*, fed by several producer threads at once, which
+            submit alone and in batches, into a small ring that fills, and
+            take completions both by callback and by polling, each other's
+            included; every job is checked against the reference
+  maps      compressed_key_map and compressed_key_set of fpaq0f2_map.hpp
+            against std::unordered_map, looked up by std::string_view and
+            by compressed_probe, with keys that compress past the 23 bytes
+            kept inline and past the probe's 256 byte buffer
+  literals  FPAQ0F2_LITERAL of fpaq0f2_literal.hpp: sizes asserted while
+            compiling, the compressed bytes against those of
+            fpaq0f2_model_compress_fixed(NULL, ...), and the expansion, first
+            raced by several threads
+
+Configure with -DCMAKE_BUILD_TYPE=Checked to run it under ASan and UBSan.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "corpus.h"
+#include "fpaq0f2.h"
+#include "fpaq0f2_literal.hpp"
+#include "fpaq0f2_map.hpp"
+#include "fpaq0f2_string.hpp"
+
+//////////////////////////// reference ////////////////////////////
+
+static size_t g_checked = 0;
+
+static void fail(const char *what, const std::string &in, const char *how) {
+  fprintf(stderr, "%s: %s, input of %zu bytes:", what, how, in.size());
+  for (size_t k = 0; k < in.size() && k < 64; ++k) fprintf(stderr, " %02x", (unsigned char)in[k]);
+  fprintf(stderr, "%s\n", in.size() > 64 ? " ..." : "");
+  exit(1);
+}
+
+// Compress with fpaq0f2_compress(), or fpaq0f2_model_compress() when there is a model.
+static std::string compress(const fpaq0f2_model *model, const std::string &in) {
+  std::string s(in.size() * 2 + 64, '\0');
+  const size_t n = model ? fpaq0f2_model_compress(model, in.data(), in.size(), &s[0], s.size())
+                         : fpaq0f2_compress(in.data(), in.size(), &s[0], s.size());
+  if (n > s.size()) fprintf(stderr, "fpaq0f2_compress failed\n"), exit(1);
+  s.resize(n);
+  return s;
+}
+
+// A chunk size: often tiny, sometimes 0, now and then large.
+static size_t chunk(fss::Rng &rng) {
+  switch (rng.below(4)) {
+  case 0: return rng.below(2);
+  case 1: return 1 + rng.below(16);
+  case 2: return 1 + rng.below(64);
+  default: return 1 + rng.below(512);
+  }
+}
+
+//////////////////////////// streams ////////////////////////////
+
+// One stream of each direction per model, reset for every value.
+struct Streams {
+  fpaq0f2_stream *c, *d;
+  explicit Streams(const fpaq0f2_model *model)
+      : c(model ? fpaq0f2_model_stream_new(model, 0) : fpaq0f2_stream_new(0)),
+        d(model ? fpaq0f2_model_stream_new(model, 1) : fpaq0f2_stream_new(1)) {
+    if (!c || !d) fprintf(stderr, "fpaq0f2_stream_new failed\n"), exit(1);
+  }
+  ~Streams() {
+    fpaq0f2_stream_free(c);
+    fpaq0f2_stream_free(d);
+  }
+};
+
+static void check_streams(const char *what, Streams &s, const std::string &in, const std::string &packed,
+                          fss::Rng &rng) {
+  char buf[512];
+  size_t used, written, calls = 0;
+  const size_t most = 64 * (in.size() + packed.size()) + 1000;  // calls that may write nothing
+
+  fpaq0f2_stream_reset(s.c);
+  std::string out;
+  for (size_t i = 0; i < in.size(); i += used) {
+    const size_t n = std::min(chunk(rng), in.size() - i), room = chunk(rng);
+    const int status = fpaq0f2_stream_update(s.c, in.data() + i, n, &used, buf, room, &written);
+    if (status == FPAQ0F2_STREAM_ERROR || used > n || written > room) fail(what, in, "compress stream update");
+    out.append(buf, written);
+    if (++calls > most) fail(what, in, "compress stream makes no progress");
+  }
+  for (int status = FPAQ0F2_STREAM_FULL; status != FPAQ0F2_STREAM_END; ) {
+    const size_t room = chunk(rng);
+    status = fpaq0f2_stream_finish(s.c, buf, room, &written);
+    if (status == FPAQ0F2_STREAM_ERROR || written > room) fail(what, in, "compress stream finish");
+    out.append(buf, written);
+    if (++calls > most) fail(what, in, "compress stream does not finish");
+  }
+  if (out != packed) fail(what, in, "a compress stream writes other bytes");
+
+  fpaq0f2_stream_reset(s.d);
+  out.clear();
+  for (size_t i = 0; ; ) {
+    const size_t room = chunk(rng);
+    int status;
+    if (i == packed.size()) {
+      status = fpaq0f2_stream_finish(s.d, buf, room, &written);
+    } else {
+      const size_t n = std::min(chunk(rng), packed.size() - i);
+      status = fpaq0f2_stream_update(s.d, packed.data() + i, n, &used, buf, room, &written);
+      if (used > n) fail(what, in, "decompress stream update");
+      i += used;
+    }
+    if (status == FPAQ0F2_STREAM_ERROR || written > room) fail(what, in, "decompress stream");
+    out.append(buf, written);
+    if (status == FPAQ0F2_STREAM_END) break;
+    if (++calls > most) fail(what, in, "decompress stream makes no progress");
+  }
+  if (out != in) fail(what, in, "a decompress stream reads other bytes");
+}
+
+//////////////////////////// vectors ////////////////////////////
+
+// Cut [p, p + len) into segments of random lengths, some of them empty.
+static std::vector<fpaq0f2_iovec> segments(char *p, size_t len, fss::Rng &rng) {
+  std::vector<fpaq0f2_iovec> v;
+  for (size_t i = 0; i < len || rng.chance(300); ) {
+    const size_t n = rng.chance(200) ? 0 : std::min(chunk(rng), len - i);
+    const fpaq0f2_iovec seg = {p + i, n};
+    v.push_back(seg);
+    i += n;
+  }
+  return v;
+}
+
+static void check_vectors(const char *what, const fpaq0f2_model *model, const std::string &in,
+                          const std::string &packed, fss::Rng &rng) {
+  std::string src = in, out(packed.size() + rng.below(8), '\0');
+  std::vector<fpaq0f2_iovec> i = segments(&src[0], src.size(), rng), o = segments(&out[0], out.size(), rng);
+  size_t n = model ? fpaq0f2_model_compressv(model, i.data(), i.size(), o.data(), o.size())
+                   : fpaq0f2_compressv(i.data(), i.size(), o.data(), o.size());
+  if (n != packed.size() || out.compare(0, n, packed)) fail(what, in, "vectors compress to other bytes");
+
+  std::string comp = packed, back(in.size() + rng.below(8), '\0');
+  i = segments(&comp[0], comp.size(), rng), o = segments(&back[0], back.size(), rng);
+  n = model ? fpaq0f2_model_decompressv(model, i.data(), i.size(), o.data(), o.size())
+            : fpaq0f2_decompressv(i.data(), i.size(), o.data(), o.size());
+  if (n != in.size() || back.compare(0, n, in)) fail(what, in, "vectors decompress to other bytes");
+}
+
+//////////////////////////// strings ////////////////////////////
+
+static const fpaq0f2_model *g_trained = NULL;
+
+struct trained_model {
+  static const fpaq0f2_model *get() { return g_trained; }
+};
+
+template <class Model>
+static void check_string(const char *what, const std::string &in, fss::Rng &rng) {
+  const fpaq0f2::basic_compressed_string<Model> s(in);
+  if (s.str() != in) fail(what, in, "compressed_string::str() differs");
+  if (std::string(s.begin(), s.end()) != in) fail(what, in, "compressed_string iterates other bytes");
+
+  const size_t n = rng.below(in.size() + 1);
+  if (!s.starts_with(std::string_view(in).substr(0, n))) fail(what, in, "starts_with() misses a prefix");
+  if (s.starts_with(in + (char)rng.next())) fail(what, in, "starts_with() takes a longer string");
+  if (n) {
+    std::string other = in.substr(0, n);
+    other[rng.below(n)] ^= 1 + rng.below(255);
+    if (s.starts_with(other)) fail(what, in, "starts_with() takes another prefix");
+  }
+}
+
+//////////////////////////// frames ////////////////////////////
+
+static void check_frames(const char *what, const fpaq0f2_model *model, const std::string &in,
+                         const std::string &packed, fss::Rng &rng) {
+  std::string back(in.size(), '\0');
+  for (int flags = 0; flags <= FPAQ0F2_FRAME_CRC; flags += FPAQ0F2_FRAME_CRC) {
+    std::string f(packed.size() + 32, '\0');
+    const size_t n = fpaq0f2_frame_compress(model, in.data(), in.size(), &f[0], f.size(), flags);
+    if (n > f.size()) fail(what, in, "fpaq0f2_frame_compress failed");
+    f.resize(n);
+
+    fpaq0f2_frame_info info;
+    if (fpaq0f2_frame_parse(f.data(), f.size(), &info) || info.length != in.size() ||
+        info.flags != (flags | (model ? FPAQ0F2_FRAME_MODEL : 0)) ||
+        info.model_id != (model ? fpaq0f2_model_id(model) : 0) || f.compare(info.header_size, n, packed))
+      fail(what, in, "a frame does not hold the value");
+    if (fpaq0f2_frame_decompress(model, f.data(), f.size(), &back[0], back.size()) != in.size() || back != in)
+      fail(what, in, "a frame decompresses to other bytes");
+    const fpaq0f2_model *const other = model ? NULL : fpaq0f2_model_default();
+    if (fpaq0f2_frame_decompress(other, f.data(), f.size(), &back[0], back.size()) != SIZE_MAX)
+      fail(what, in, "a frame decompresses with another model");
+
+    // With a CRC, any flipped byte or missing tail fails; without one, a short header.
+    const size_t cut = flags ? rng.below(f.size()) : rng.below(info.header_size);
+    if (fpaq0f2_frame_decompress(model, f.data(), cut, &back[0], back.size()) != SIZE_MAX)
+      fail(what, in, "a truncated frame decompresses");
+    if (flags) {
+      f[rng.below(f.size())] ^= 1 << rng.below(8);
+      if (fpaq0f2_frame_decompress(model, f.data(), f.size(), &back[0], back.size()) != SIZE_MAX)
+        fail(what, in, "a frame with a flipped byte decompresses");
+    }
+  }
+}
+
+//////////////////////////// fixed width ////////////////////////////
+
+static std::string compress_fixed(const fpaq0f2_model *model, const char *in, size_t len) {
+  std::string s(len * 2 + 64, '\0');
+  const size_t n = model ? fpaq0f2_model_compress_fixed(model, in, len, &s[0], s.size())
+                         : fpaq0f2_compress_fixed(in, len, &s[0], s.size());
+  if (n > s.size()) return "<failed>";
+  s.resize(n);
+  return s;
+}
+
+static void check_fixed(const char *what, const fpaq0f2_model *model, const std::string &in, fss::Rng &rng) {
+  const std::string packed = compress_fixed(model, in.data(), in.size());
+  std::string back(in.size(), '\0');
+  const size_t n = model ? fpaq0f2_model_decompress_fixed(model, packed.data(), packed.size(), &back[0], in.size())
+                         : fpaq0f2_decompress_fixed(packed.data(), packed.size(), &back[0], in.size());
+  if (n != in.size() || back != in) fail(what, in, "a fixed width value decompresses to other bytes");
+  if (!model) return;
+
+  // The input cut into count values of width bytes, each compressed alone, in a buffer
+  // that fits them exactly, and in one a byte short.
+  const size_t width = 1 + rng.below(32), count = in.size() / width;
+  std::string expect;
+  for (size_t k = 0; k < count; ++k) expect += compress_fixed(model, &in[k * width], width);
+  std::string out(expect.size() + 1, '\0');
+  std::vector<size_t> offsets(count + 1);
+  const size_t total = fpaq0f2_model_compress_batch(model, in.data(), width, count, &out[0], expect.size(),
+                                                    offsets.data());
+  if (total != expect.size() || offsets[0] != 0 || offsets[count] != total || out.compare(0, total, expect))
+    fail(what, in, "a batch differs from its values compressed by fpaq0f2_model_compress_fixed()");
+  if (total && fpaq0f2_model_compress_batch(model, in.data(), width, count, &out[0], total - 1,
+                                            offsets.data()) != total)
+    fail(what, in, "a batch overflows its buffer");
+  fpaq0f2_model_compress_batch(model, in.data(), width, count, &out[0], total, offsets.data());
+  back.assign(width * count, '\0');
+  if (fpaq0f2_model_decompress_batch(model, out.data(), total, offsets.data(), count, width, &back[0]) !=
+          width * count || in.compare(0, width * count, back))
+    fail(what, in, "a batch decompresses to other bytes");
+}
+
+//////////////////////////// queue ////////////////////////////
+
+// A job, its compressed input if it decompresses, and what it must give. complete is set by the done callback, or by whichever
+// producer polls the job, and read by the one that submitted it.
+struct Slot {
+  fpaq0f2_job job;
+  const std::string *in;
+  std::string packed, expect, out;
+  std::atomic<bool> complete;
+  Slot(): in(NULL), complete(false) {}
+};
+
+static void slot_done(fpaq0f2_job *job) {
+  static_cast<Slot *>(job->user)->complete.store(true, std::memory_order_release);
+}
+
+static void poll_slots(fpaq0f2_queue *q) {
+  fpaq0f2_job *jobs[16];
+  for (size_t n = fpaq0f2_queue_poll(q, jobs, 16), k = 0; k < n; ++k) slot_done(jobs[k]);
+}
+
+static std::atomic<size_t> g_jobs(0);
+
+// Queue a compress and a decompress job per model for each input k with k % step ==
+// first, a window of them at a time, and check each against the reference.
+static void produce(fpaq0f2_queue *q, const std::vector<const fpaq0f2_model *> *models,
+                    const std::vector<std::string> *inputs, size_t first, size_t step, uint64_t seed) {
+  fss::Rng rng(seed);
+  for (size_t k = first; k < inputs->size(); ) {
+    std::vector<std::unique_ptr<Slot> > window;
+    for (size_t w = 1 + rng.below(32); w && k < inputs->size(); --w, k += step) {
+      const std::string &in = (*inputs)[k];
+      for (size_t m = 0; m < models->size(); ++m) {
+        const std::string packed = compress((*models)[m], in);
+        for (int op = FPAQ0F2_JOB_COMPRESS; op <= FPAQ0F2_JOB_DECOMPRESS; ++op) {
+          Slot *s = new Slot;
+          window.emplace_back(s);
+          s->in = &in;
+          if (op == FPAQ0F2_JOB_DECOMPRESS) s->packed = packed;
+          s->expect = op == FPAQ0F2_JOB_COMPRESS ? packed : in;
+          s->out.assign(op == FPAQ0F2_JOB_COMPRESS ? in.size() * 2 + 64 : in.size(), '\0');
+          const std::string &src = op == FPAQ0F2_JOB_COMPRESS ? in : s->packed;
+          s->job.op = op;
+          s->job.model = (*models)[m];
+          s->job.in = src.data();
+          s->job.len = src.size();
+          s->job.out = &s->out[0];
+          s->job.bufsize = s->out.size();
+          s->job.done = rng.below(2) ? slot_done : NULL;
+          s->job.user = s;
+          s->job.result = 0;
+        }
+      }
+    }
+    for (size_t i = 0; i < window.size(); ) {
+      if (rng.below(2)) {
+        std::vector<fpaq0f2_job *> jobs;
+        for (size_t j = i; j < window.size(); ++j) jobs.push_back(&window[j]->job);
+        i += fpaq0f2_queue_submit_batch(q, jobs.data(), jobs.size());
+      } else if (fpaq0f2_queue_submit(q, &window[i]->job) == 0) {
+        ++i;
+        continue;
+      }
+      poll_slots(q);
+      std::this_thread::yield();
+    }
+    for (size_t i = 0; i < window.size(); ++i)
+      while (!window[i]->complete.load(std::memory_order_acquire)) {
+        poll_slots(q);
+        std::this_thread::yield();
+      }
+
+    for (size_t i = 0; i < window.size(); ++i) {
+      const Slot &s = *window[i];
+      const char *what = s.job.model ? "queue, frozen model" : "queue, adaptive";
+      if (s.job.result != s.expect.size() || s.out.compare(0, s.job.result, s.expect))
+        fail(what, *s.in, s.job.op == FPAQ0F2_JOB_COMPRESS ? "a queued compress writes other bytes"
+                                                           : "a queued decompress reads other bytes");
+    }
+    g_jobs += window.size();
+  }
+}
+
+static void check_queue(const std::vector<const fpaq0f2_model *> &models, const std::vector<std::string> &inputs,
+                        unsigned producers, uint64_t seed) {
+  fpaq0f2_queue *const q = fpaq0f2_queue_new(4, 64);
+  if (!q) fprintf(stderr, "fpaq0f2_queue_new failed\n"), exit(1);
+  std::vector<std::thread> threads;
+  for (unsigned p = 0; p < producers; ++p)
+    threads.emplace_back(produce, q, &models, &inputs, p, producers, seed + p);
+  for (size_t p = 0; p < threads.size(); ++p) threads[p].join();
+  fpaq0f2_queue_free(q);
+}
+
+//////////////////////////// maps ////////////////////////////
+
+// Insert the keys, and two of random bytes that compress past the inline and probe
+// buffers, mapped to their index, each in one of the 4 ways, into a map, a set and a
+// std::unordered_map, then look up, iterate and erase half of them.
+template <class Model>
+static void check_maps(const char *what, std::vector<std::string> keys, fss::Rng &rng) {
+  for (size_t len : {64, 512}) {
+    keys.emplace_back(len, '\0');
+    for (size_t k = 0; k < len; ++k) keys.back()[k] = (char)rng.next();
+  }
+
+  typedef fpaq0f2::basic_compressed_string<Model> key_type;
+  typedef fpaq0f2::compressed_probe<Model> probe_type;
+  fpaq0f2::compressed_key_map<size_t, Model> m;
+  fpaq0f2::compressed_key_set<Model> s;
+  std::unordered_map<std::string, size_t> ref;
+  size_t heap_keys = 0, spilled_probes = 0;
+
+  for (size_t k = 0; k < keys.size(); ++k) {
+    const std::string &key = keys[k];
+    bool added, expect;
+    switch (rng.below(4)) {
+    case 0: added = m.emplace(key, k).second, expect = ref.emplace(key, k).second; break;
+    case 1: added = m.insert(key, k).second, expect = ref.emplace(key, k).second; break;
+    case 2: added = !m.contains(key), m[key] = k, expect = ref.insert_or_assign(key, k).second; break;
+    default: added = m.insert_or_assign(key, k).second, expect = ref.insert_or_assign(key, k).second;
+    }
+    if (added != expect) fail(what, key, "a map insert differs from std::unordered_map");
+    if (s.insert(key).second != expect) fail(what, key, "a set insert differs from std::unordered_map");
+  }
+  if (m.size() != ref.size() || s.size() != ref.size()) fail(what, "", "a map holds other keys");
+
+  for (size_t k = 0; k < keys.size(); ++k) {
+    const std::string &key = keys[k];
+    const key_type stored(key);
+    const probe_type probe(key);
+    heap_keys += !stored.is_inline();
+    spilled_probes += probe.bytes().size() > 256;
+    if (probe.bytes() != fpaq0f2::detail::compressed_hash<Model>::view(stored))
+      fail(what, key, "a probe compresses to other bytes than the key");
+    if (fpaq0f2::detail::compressed_hash<Model>()(probe.bytes()) != fpaq0f2::detail::compressed_hash<Model>()(stored))
+      fail(what, key, "a probe hashes unlike the key");
+
+    auto it = m.find(std::string_view(key));
+    if (m.end() == it || it != m.find(probe) || it->second != ref[key] || it->first.str() != key)
+      fail(what, key, "a map lookup misses the key");
+    if (m.at(key) != ref[key] || m.count(key) != 1) fail(what, key, "a map lookup misses the key");
+    if (s.end() == s.find(probe) || s.find(probe) != s.find(key) || !s.contains(key))
+      fail(what, key, "a set lookup misses the key");
+
+    const std::string other = key + (char)rng.next();
+    if (!ref.count(other)) {
+      if (m.end() != m.find(other) || m.end() != m.find(probe_type(other)) || s.count(other))
+        fail(what, key, "a lookup finds a missing key");
+      bool thrown = false;
+      try {
+        m.at(other);
+      } catch (const std::out_of_range &) {
+        thrown = true;
+      }
+      if (!thrown) fail(what, key, "at() takes a missing key");
+    }
+  }
+  if (!heap_keys || !spilled_probes) fail(what, "", "no key compresses past the inline or probe buffers");
+
+  size_t seen = 0;
+  for (auto it = m.begin(); it != m.end(); ++it, ++seen) {
+    const std::string key = it->first.str();
+    if (!ref.count(key) || ref[key] != it->second) fail(what, key, "a map iterates another key");
+  }
+  for (auto it = s.begin(); it != s.end(); ++it)
+    if (!ref.count(it->str())) fail(what, it->str(), "a set iterates another key");
+  if (seen != ref.size()) fail(what, "", "a map iterates other keys");
+
+  for (size_t k = 0; k < keys.size(); k += 2) {
+    const size_t erased = ref.erase(keys[k]);
+    if (m.erase(keys[k]) != erased || s.erase(keys[k]) != erased) fail(what, keys[k], "an erase differs");
+    if (m.contains(keys[k]) || s.contains(keys[k])) fail(what, keys[k], "an erased key is found");
+  }
+  if (m.size() != ref.size() || s.size() != ref.size()) fail(what, "", "a map holds other keys after erase");
+}
+
+//////////////////////////// literals ////////////////////////////
+
+static constexpr char g_sql[] =
+    "SELECT u.id, u.name, u.email, count(o.id) AS orders FROM users u LEFT JOIN orders o ON o.user_id = u.id "
+    "WHERE u.created_at >= ? AND u.status = 'active' GROUP BY u.id, u.name, u.email ORDER BY orders DESC LIMIT 100";
+static constexpr char g_nuls[] = "key\0value\0\0\0tail with a NUL at the end of the text of the message\0";
+static constexpr char g_dense[] = "\xf1\x07\x9c\x3e\xa5\x58\xd2\x6b";
+static constexpr char g_empty[] = "";
+
+static constexpr auto g_sql_c = fpaq0f2::detail::compress_literal<sizeof(g_sql) - 1>(g_sql);
+static constexpr auto g_nuls_c = fpaq0f2::detail::compress_literal<sizeof(g_nuls) - 1>(g_nuls);
+static constexpr auto g_dense_c = fpaq0f2::detail::compress_literal<sizeof(g_dense) - 1>(g_dense);
+static constexpr auto g_empty_c = fpaq0f2::detail::compress_literal<sizeof(g_empty) - 1>(g_empty);
+static_assert(sizeof(g_sql) - 1 == 213 && g_sql_c.size == 165, "the query shrinks by 48 bytes");
+static_assert(sizeof(g_nuls) - 1 == 66 && g_nuls_c.size == 51, "NULs are bytes like any other");
+static_assert(g_dense_c.size >= sizeof(g_dense) - 1, "dense bytes do not shrink, so are kept as they are");
+static_assert(g_empty_c.size == 1, "an empty literal flushes 1 byte, and is kept as no bytes");
+
+static std::string_view sql_text() { return FPAQ0F2_LITERAL(g_sql); }
+
+template <size_t N>
+static void check_literal(const char *what, std::string_view text, const char (&s)[N],
+                          const fpaq0f2::detail::compressed_literal<N - 1> &c) {
+  const std::string in(s, N - 1);
+  if (text != in || text.data()[N - 1] != 0) fail(what, in, "a literal expands to other bytes");
+  char buf[N * 5 / 2 + 8];
+  if (fpaq0f2_model_compress_fixed(NULL, s, N - 1, buf, sizeof(buf)) != c.size || memcmp(buf, c.bytes, c.size))
+    fail(what, in, "a literal compresses to other bytes than fpaq0f2_model_compress_fixed(NULL, ...)");
+}
+
+static void check_literals() {
+  std::string_view first[4];
+  std::vector<std::thread> threads;
+  for (int k = 0; k < 4; ++k) threads.emplace_back([&first, k] { first[k] = sql_text(); });
+  for (int k = 0; k < 4; ++k) threads[k].join();
+  for (int k = 1; k < 4; ++k)
+    if (first[k].data() != first[0].data()) fail("literals", g_sql, "a literal expands into two places");
+  if (sql_text().data() != first[0].data()) fail("literals", g_sql, "a literal expands twice");
+
+  check_literal("literals, a query", first[0], g_sql, g_sql_c);
+  check_literal("literals, NULs", FPAQ0F2_LITERAL(g_nuls), g_nuls, g_nuls_c);
+  check_literal("literals, dense bytes", FPAQ0F2_LITERAL(g_dense), g_dense, g_dense_c);
+  check_literal("literals, empty", FPAQ0F2_LITERAL(g_empty), g_empty, g_empty_c);
+}
+
+//////////////////////////// checks ////////////////////////////
+
+// A model to check, with its streams, and its compressed_string check if frozen.
+struct Subject {
+  const char *name;
+  const fpaq0f2_model *model;  // NULL for adaptive coding
+  Streams streams;
+  void (*strings)(const char *, const std::string &, fss::Rng &);
+  Subject(const char *n, const fpaq0f2_model *m, void (*f)(const char *, const std::string &, fss::Rng &))
+      : name(n), model(m), streams(m), strings(f) {}
+};
+
+static void check(std::vector<Subject *> &subjects, const std::string &in, const char *kind, fss::Rng &rng) {
+  for (size_t k = 0; k < subjects.size(); ++k) {
+    Subject &s = *subjects[k];
+    const std::string what = std::string(kind) + ", " + s.name;
+    const std::string packed = compress(s.model, in);
+    check_streams(what.c_str(), s.streams, in, packed, rng);
+    check_vectors(what.c_str(), s.model, in, packed, rng);
+    if (s.strings) s.strings(what.c_str(), in, rng);
+    check_frames(what.c_str(), s.model, in, packed, rng);
+    check_fixed(what.c_str(), s.model, in, rng);
+  }
+  ++g_checked;
+}
+
+//////////////////////////// main ////////////////////////////
+
+int main(int argc, char **argv) {
+  size_t count = 2000;
+  uint64_t seed = 1;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "-n")) count = strtoul(argv[i + 1], NULL, 10);
+    else if (!strcmp(argv[i], "-s")) seed = strtoull(argv[i + 1], NULL, 10);
+    else fprintf(stderr, "usage: api_check [-n count] [-s seed]\n"), exit(2);
+  }
+  check_literals();
+
+  std::vector<std::vector<std::string> > corpora(fss::KIND_COUNT);
+  std::string samples;
+  std::vector<size_t> lens;
+  for (int k = 0; k < fss::KIND_COUNT; ++k) {
+    fss::Config cfg;
+    cfg.kind = (fss::Kind)k;
+    cfg.seed = seed;
+    cfg.utf8_per_mille = k == fss::WORDS ? 100 : 0;
+    fss::Generator gen(cfg);
+    for (size_t n = 0; n < count; ++n) {
+      corpora[k].push_back(gen.next());
+      samples += corpora[k].back();
+      lens.push_back(corpora[k].back().size());
+    }
+  }
+  fpaq0f2_model *const trained = fpaq0f2_model_train(samples.data(), lens.data(), lens.size());
+  if (!trained) fprintf(stderr, "fpaq0f2_model_train failed\n"), exit(1);
+  g_trained = trained;
+
+  Subject adaptive("adaptive", NULL, NULL),
+      builtin("default model", fpaq0f2_model_default(), check_string<fpaq0f2::default_model>),
+      frozen("trained model", trained, check_string<trained_model>);
+  std::vector<Subject *> subjects = {&adaptive, &builtin, &frozen};
+
+  fss::Rng rng(seed);
+  std::vector<std::string> queued;
+  for (int k = 0; k < fss::KIND_COUNT; ++k) {
+    std::string whole;
+    for (size_t n = 0; n < corpora[k].size(); ++n) {
+      check(subjects, corpora[k][n], fss::kind_names[k], rng);
+      whole += corpora[k][n];
+      queued.push_back(corpora[k][n]);
+    }
+    check(subjects, whole, fss::kind_names[k], rng);
+  }
+
+  // Random inputs: every byte value, skewed bytes, runs, and the lengths around
+  // the coder's 4 byte window.
+  for (size_t n = 0; n < count; ++n) {
+    std::string s(n < 16 ? n : rng.below(4096), '\0');
+    const int mode = rng.below(4);
+    for (size_t k = 0; k < s.size(); ++k) {
+      if (mode == 0) s[k] = (char)rng.next();
+      else if (mode == 1) s[k] = (char)(rng.below(4) ? 0 : 255);
+      else if (mode == 2) s[k] = (char)("ab"[rng.below(2)]);
+      else s[k] = (char)(k / (1 + rng.below(64)));
+    }
+    check(subjects, s, "random", rng);
+    queued.push_back(s);
+  }
+
+  std::vector<const fpaq0f2_model *> models;
+  for (size_t k = 0; k < subjects.size(); ++k) models.push_back(subjects[k]->model);
+  check_queue(models, queued, 4, seed);
+  check_maps<fpaq0f2::default_model>("maps, default model", queued, rng);
+  check_maps<trained_model>("maps, trained model", queued, rng);
+
+  printf("%zu inputs pass every check with %zu models\n", g_checked, subjects.size());
+  printf("%zu queue jobs from 4 producers pass\n", g_jobs.load());
+  fpaq0f2_model_free(trained);
+  return 0;
+}
@@ -0,0 +1,62 @@
+#ifndef __FSS_APIS_H__
+#define __FSS_APIS_H__
+
+/* The ways of calling fpaq0f2 that fss_latency and fss_threads compare, behind one
+ * signature. Each call gets the caller's context and frozen model, and uses the one it
+ * needs, if any:
+ *   one-shot  fpaq0f2_compress(), which allocates and initializes a 256 KB model on
+ *             every call
+ *   context   fpaq0f2_ctx_compress() with ctx
+ *   frozen    fpaq0f2_model_compress() with model
+ */
+
+#include <stddef.h>
+
+#include "fpaq0f2.h"
+
+namespace fss {
+
+// Each API returns the output size, or more than bufsize if it does not fit.
+struct Api {
+  const char *name;
+  size_t (*compress)(fpaq0f2_ctx *ctx, const fpaq0f2_model *model, const char *in, size_t len, char *out,
+                     size_t bufsize);
+  size_t (*decompress)(fpaq0f2_ctx *ctx, const fpaq0f2_model *model, const char *in, size_t len, char *out,
+                       size_t bufsize);
+};
+
+inline size_t oneshot_c(fpaq0f2_ctx *, const fpaq0f2_model *, const char *in, size_t len, char *out,
+                        size_t bufsize) {
+  return fpaq0f2_compress(in, len, out, bufsize);
+}
+inline size_t oneshot_d(fpaq0f2_ctx *, const fpaq0f2_model *, const char *in, size_t len, char *out,
+                        size_t bufsize) {
+  return fpaq0f2_decompress(in, len, out, bufsize);
+}
+inline size_t context_c(fpaq0f2_ctx *ctx, const fpaq0f2_model *, const char *in, size_t len, char *out,
+                        size_t bufsize) {
+  return fpaq0f2_ctx_compress(ctx, in, len, out, bufsize);
+}
+inline size_t context_d(fpaq0f2_ctx *ctx, const fpaq0f2_model *, const char *in, size_t len, char *out,
+                        size_t bufsize) {
+  return fpaq0f2_ctx_decompress(ctx, in, len, out, bufsize);
+}
+inline size_t frozen_c(fpaq0f2_ctx *, const fpaq0f2_model *model, const char *in, size_t len, char *out,
+                       size_t bufsize) {
+  return fpaq0f2_model_compress(model, in, len, out, bufsize);
+}
+inline size_t frozen_d(fpaq0f2_ctx *, const fpaq0f2_model *model, const char *in, size_t len, char *out,
+                       size_t bufsize) {
+  return fpaq0f2_model_decompress(model, in, len, out, bufsize);
+}
+
+static const Api apis[] = {
+  {"one-shot", oneshot_c, oneshot_d},
+  {"context", context_c, context_d},
+  {"frozen", frozen_c, frozen_d},
+};
+static const size_t API_COUNT = sizeof(apis) / sizeof(apis[0]);
+
+} // namespace fss
+
+#endif /* __FSS_APIS_H__ */
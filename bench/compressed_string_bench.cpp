@@ -0,0 +1,163 @@
+/* compressed_string_bench - fpaq0f2::compressed_string against std::string.
+
+To compile: g++ -O2 -std=c++17 -I../ext/fpaq0f2 compressed_string_bench.cpp ../ext/fpaq0f2/fpaq0f2.cpp
+To run:     compressed_string_bench [count]
+
+Builds, sorts and reads back the same set of short keys both as std::string and
+as compressed_string, and reports the time, heap allocations, heap bytes and
+resident set growth of each.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "fpaq0f2_string.hpp"
+
+//////////////////////////// allocation counting ////////////////////////////
+
+static size_t g_allocs = 0;
+static size_t g_alloc_bytes = 0;
+
+static void *counted_alloc(size_t n) {
+  ++g_allocs;
+  g_alloc_bytes += n;
+  void *p = malloc(n ? n : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new(size_t n) { return counted_alloc(n); }
+void *operator new[](size_t n) { return counted_alloc(n); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+static long rss_kb() {
+  long pages = 0, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (!f) return 0;
+  if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+  fclose(f);
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+//////////////////////////// keys ////////////////////////////
+
+// Short keys with the shape of typical cache and session keys.
+static std::vector<std::string> make_keys(size_t count) {
+  static const char *const kinds[] = {"user", "session", "order", "item", "cart"};
+  static const char *const fields[] = {"profile", "name", "email", "last_seen", "tags"};
+  std::vector<std::string> keys;
+  keys.reserve(count);
+  unsigned long long seed = 0x9e3779b97f4a7c15ULL;
+  char buf[64];
+  for (size_t i = 0; i < count; ++i) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    const unsigned r = (unsigned)(seed >> 33);
+    snprintf(buf, sizeof(buf), "%s:%u:%s", kinds[r % 5], r % 1000003, fields[(r >> 20) % 5]);
+    keys.push_back(buf);
+  }
+  return keys;
+}
+
+//////////////////////////// model ////////////////////////////
+
+static fpaq0f2_model *g_model = NULL;
+
+struct key_model {
+  static const fpaq0f2_model *get() { return g_model; }
+};
+typedef fpaq0f2::basic_compressed_string<key_model> compressed_key;
+
+//////////////////////////// main ////////////////////////////
+
+struct Stats {
+  double build_ms, sort_ms, read_ms;
+  size_t allocs, alloc_bytes;
+  long rss_kb;
+};
+
+static double ms_since(std::chrono::steady_clock::time_point t) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t).count();
+}
+
+template <class S, class Build, class Read>
+static Stats run(const std::vector<std::string> &keys, Build build, Read read) {
+  Stats st;
+  const size_t allocs = g_allocs, bytes = g_alloc_bytes;
+  const long rss = rss_kb();
+  std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+
+  std::vector<S> v;
+  v.reserve(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i)
+    v.push_back(build(keys[i]));
+  st.build_ms = ms_since(t);
+  st.allocs = g_allocs - allocs;
+  st.alloc_bytes = g_alloc_bytes - bytes;
+  st.rss_kb = rss_kb() - rss;
+
+  t = std::chrono::steady_clock::now();
+  std::sort(v.begin(), v.end());
+  st.sort_ms = ms_since(t);
+
+  t = std::chrono::steady_clock::now();
+  char buf[256];
+  size_t sum = 0;
+  for (size_t i = 0; i < v.size(); ++i)
+    sum += read(v[i], buf, sizeof(buf));
+  st.read_ms = ms_since(t);
+  if (sum == 0) fprintf(stderr, "nothing read\n");
+  return st;
+}
+
+static void print(const char *name, const Stats &st, size_t count) {
+  printf("%-18s build %8.1f ms  sort %8.1f ms  read %8.1f ms  allocs %9zu  heap %10zu B"
+         "  (%5.1f B/key)  rss +%ld KB\n",
+         name, st.build_ms, st.sort_ms, st.read_ms, st.allocs, st.alloc_bytes,
+         (double)st.alloc_bytes / count, st.rss_kb);
+}
+
+int main(int argc, char **argv) {
+  const size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  std::vector<std::string> keys = make_keys(count);
+
+  // Train the shared frozen model on a sample of the keys.
+  std::string samples;
+  std::vector<size_t> lens;
+  for (size_t i = 0; i < keys.size() && i < 10000; ++i) {
+    samples += keys[i];
+    lens.push_back(keys[i].size());
+  }
+  g_model = fpaq0f2_model_train(samples.data(), lens.data(), lens.size());
+  if (!g_model) fprintf(stderr, "out of memory\n"), exit(1);
+
+  printf("%zu keys, sizeof(std::string) = %zu, sizeof(compressed_string) = %zu\n",
+         count, sizeof(std::string), sizeof(compressed_key));
+
+  Stats s = run<std::string>(keys,
+      [](const std::string &k) { return k; },
+      [](const std::string &s, char *buf, size_t n) {
+        const size_t len = std::min(n, s.size());
+        memcpy(buf, s.data(), len);
+        return len;
+      });
+  print("std::string", s, count);
+
+  Stats c = run<compressed_key>(keys,
+      [](const std::string &k) { return compressed_key(k); },
+      [](const compressed_key &s, char *buf, size_t n) { return s.copy(buf, n); });
+  print("compressed_string", c, count);
+
+  fpaq0f2_model_free(g_model);
+  return 0;
+}
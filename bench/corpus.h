@@ -0,0 +1,363 @@
+#ifndef __FSS_CORPUS_H__
+#define __FSS_CORPUS_H__
+
+/* Deterministic synthetic corpora of short strings, shared by the benchmarks and the
+ * corpus and training tools, and the length-prefixed file format they exchange.
+ *
+ * The same seed and Config generate the same strings on every machine: the random
+ * generator is fixed, and every table is built from the seed with correctly rounded
+ * arithmetic only.
+ *
+ * A corpus file is a sequence of records, each a LEB128 varint length followed by that
+ * many bytes, with no header, so files can be concatenated.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+namespace fss {
+
+//////////////////////////// random ////////////////////////////
+
+// splitmix64, fixed so every platform sees the same stream.
+struct Rng {
+  uint64_t s;
+  explicit Rng(uint64_t seed): s(seed) {}
+  uint64_t next() {
+    uint64_t z = (s += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+  size_t below(size_t n) { return n ? next() % n : 0; }
+  // True with probability per_mille / 1000.
+  bool chance(unsigned per_mille) { return below(1000) < per_mille; }
+};
+
+/* Samples ranks 0..n-1 with P(k) proportional to 1/(k+1)^s, by a binary search of
+ * a fixed point CDF. The weights are computed with correctly rounded operations only,
+ * so the CDF is the same on every IEEE 754 platform.
+ */
+class Zipf {
+public:
+  Zipf(size_t n, double s): cdf(n) {
+    double sum = 0;
+    std::vector<double> w(n);
+    for (size_t k = 0; k < n; ++k) sum += w[k] = 1.0 / pow_(k + 1.0, s);
+    double acc = 0;
+    for (size_t k = 0; k < n; ++k) {
+      acc += w[k];
+      cdf[k] = (uint64_t)(acc / sum * 18446744073709549568.0);
+    }
+    if (n) cdf[n - 1] = UINT64_MAX;
+  }
+  size_t operator()(Rng &r) const {
+    const uint64_t u = r.next();
+    size_t lo = 0, hi = cdf.size() - 1;
+    while (lo < hi) {
+      const size_t mid = (lo + hi) / 2;
+      if (cdf[mid] < u) lo = mid + 1;
+      else hi = mid;
+    }
+    return lo;
+  }
+  size_t size() const { return cdf.size(); }
+
+private:
+  std::vector<uint64_t> cdf;
+  // pow() may differ in the last bit between libms, products and square roots do not.
+  static double pow_(double x, double s) {
+    const int whole = (int)s;
+    double r = 1;
+    for (int i = 0; i < whole; ++i) r *= x;
+    double frac = s - whole, b = x;
+    for (int i = 0; i < 20 && frac > 0; ++i) {  // binary expansion of the fraction
+      b = sqrt(b);
+      frac *= 2;
+      if (frac >= 1) r *= b, frac -= 1;
+    }
+    return r;
+  }
+};
+
+//////////////////////////// config ////////////////////////////
+
+enum Kind { URLS, EMAILS, PATHS, JSON_KEYS, WORDS, LOGS, IDS, CACHE_KEYS, KIND_COUNT };
+
+static const char *const kind_names[KIND_COUNT] = {
+  "urls", "emails", "paths", "json_keys", "words", "logs", "ids", "cache_keys",
+};
+
+enum IdFormat { ID_UUID, ID_HEX, ID_DECIMAL, ID_BASE64, ID_FORMAT_COUNT };
+
+static const char *const id_format_names[ID_FORMAT_COUNT] = {"uuid", "hex", "decimal", "base64"};
+
+// A bucket of a length histogram: strings of at most max_len bytes, with weight.
+struct LengthBucket {
+  size_t max_len;
+  unsigned weight;
+};
+
+struct Config {
+  Kind kind = URLS;
+  uint64_t seed = 1;
+  size_t hosts = 1000;         // distinct hostnames
+  double host_zipf = 1.1;      // Zipf exponent of hostnames and words
+  unsigned max_depth = 6;      // path segments, uniform in 0..max_depth
+  IdFormat id_format = ID_UUID;
+  unsigned utf8_per_mille = 0; // words drawn from non-ASCII scripts
+  std::vector<LengthBucket> lengths;  // by increasing max_len, empty for natural lengths
+};
+
+//////////////////////////// vocabulary ////////////////////////////
+
+static const char *const english[] = {
+  "the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "was", "with", "be", "by",
+  "on", "not", "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an",
+  "had", "they", "you", "were", "their", "one", "all", "we", "can", "her", "has", "there",
+  "been", "if", "more", "when", "will", "would", "who", "so", "no", "time", "people", "year",
+  "state", "world", "government", "company", "system", "program", "question", "during",
+  "number", "information", "development", "university", "national", "international",
+  "management", "performance", "relationship", "environment", "understanding", "particular",
+  "community", "experience", "important", "different", "following", "available", "children",
+  "business", "service", "history", "research", "country", "between", "because", "through",
+};
+
+// Words of other scripts, as UTF-8.
+static const char *const foreign[] = {
+  "stra\xc3\x9f" "e", "caf\xc3\xa9", "na\xc3\xafve", "\xc3\xa5r", "m\xc3\xbcller",
+  "\xd0\xbc\xd0\xbe\xd1\x81\xd0\xba\xd0\xb2\xd0\xb0", "\xd0\xb4\xd0\xb0\xd0\xbd\xd0\xbd\xd1\x8b\xd0\xb5",
+  "\xce\xb1\xce\xbb\xcf\x86\xce\xb1", "\xd7\xa9\xd7\x9c\xd7\x95\xd7\x9d",
+  "\xd9\x85\xd8\xb1\xd8\xad\xd8\xa8\xd8\xa7", "\xe6\x97\xa5\xe6\x9c\xac",
+  "\xe6\x95\xb0\xe6\x8d\xae", "\xe3\x83\x87\xe3\x83\xbc\xe3\x82\xbf", "\xed\x95\x9c\xea\xb5\xad",
+  "\xe0\xa4\xa8\xe0\xa4\xae\xe0\xa4\xb8\xe0\xa5\x8d\xe0\xa4\xa4\xe0\xa5\x87",
+  "\xf0\x9f\x98\x80", "\xf0\x9f\x9a\x80",
+};
+
+static const char *const names[] = {
+  "john", "mary", "james", "linda", "robert", "patricia", "michael", "jennifer", "wei",
+  "fatima", "olga", "carlos", "aiko", "smith", "garcia", "nguyen", "mueller", "kowalski",
+};
+static const char *const tlds[] = {"com", "org", "net", "io", "de", "co.uk", "fr", "jp"};
+static const char *const dirs[] = {
+  "usr", "lib", "home", "var", "log", "src", "include", "share", "local", "bin", "etc", "tmp",
+  "opt", "data", "build", "test", "docs", "node_modules", "python3.11", "site-packages",
+};
+static const char *const exts[] = {"c", "h", "cpp", "py", "js", "json", "txt", "log", "so", "md"};
+static const char *const keys[] = {
+  "id", "name", "type", "value", "created_at", "updated_at", "user_id", "status", "email",
+  "description", "items", "count", "url", "title", "price", "currency", "metadata", "tags",
+};
+static const char *const levels[] = {"INFO", "DEBUG", "WARN", "ERROR"};
+static const char *const components[] = {"http", "db", "cache", "auth", "worker", "scheduler"};
+static const char *const syllables[] = {
+  "ka", "lo", "mi", "net", "ra", "shop", "data", "cloud", "ex", "in", "web", "app", "go",
+  "tech", "media", "star", "blue", "one", "hub", "base",
+};
+
+#define FSS_COUNTOF(a) (sizeof(a) / sizeof((a)[0]))
+
+//////////////////////////// generator ////////////////////////////
+
+class Generator {
+public:
+  explicit Generator(const Config &c)
+      : cfg(c), rng(c.seed), host_rank(c.hosts ? c.hosts : 1, c.host_zipf),
+        word_rank(FSS_COUNTOF(english), c.host_zipf) {
+    Rng h(c.seed ^ 0x686f737473ULL);  // the hostnames depend on the seed only
+    for (size_t k = 0; k < host_rank.size(); ++k) {
+      std::string s = h.below(3) ? "www." : h.below(2) ? "api." : "";
+      for (size_t n = 1 + h.below(3); n; --n) s += syllables[h.below(FSS_COUNTOF(syllables))];
+      s += ".";
+      s += tlds[h.below(FSS_COUNTOF(tlds))];
+      host_names.push_back(s);
+    }
+    for (size_t k = 0; k < cfg.lengths.size(); ++k) length_total += cfg.lengths[k].weight;
+  }
+
+  std::string next() {
+    if (0 == length_total) return natural();
+
+    // Pick a bucket, then grow natural strings to within it.
+    size_t w = rng.below(length_total), b = 0;
+    while (w >= cfg.lengths[b].weight) w -= cfg.lengths[b++].weight;
+    const size_t lo = b ? cfg.lengths[b - 1].max_len + 1 : 0, hi = cfg.lengths[b].max_len;
+    std::string s = natural();
+    while (s.size() < lo) s += separator(), s += natural();
+    truncate(s, hi);
+    return s;
+  }
+
+private:
+  const Config cfg;
+  Rng rng;
+  Zipf host_rank, word_rank;
+  std::vector<std::string> host_names;
+  unsigned length_total = 0;
+
+  template <size_t N> const char *pick(const char *const (&a)[N]) { return a[rng.below(N)]; }
+
+  const char *word() {
+    if (cfg.utf8_per_mille && rng.chance(cfg.utf8_per_mille)) return pick(foreign);
+    return english[word_rank(rng)];
+  }
+  const std::string &host() { return host_names[host_rank(rng)]; }
+
+  const char *separator() {
+    static const char *const seps[] = {" ", "/", ":", ",", "|"};
+    return seps[cfg.kind % FSS_COUNTOF(seps)];
+  }
+
+  // Cut s to at most n bytes, not inside a UTF-8 sequence.
+  static void truncate(std::string &s, size_t n) {
+    if (s.size() <= n) return;
+    while (n > 0 && (s[n] & 0xc0) == 0x80) --n;
+    s.resize(n);
+  }
+
+  std::string id() {
+    char buf[64];
+    const uint64_t a = rng.next(), b = rng.next();
+    switch (cfg.id_format) {
+    case ID_HEX:
+      snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)a);
+      break;
+    case ID_DECIMAL:
+      snprintf(buf, sizeof(buf), "%llu", (unsigned long long)(a % 10000000000ULL));
+      break;
+    case ID_BASE64: {
+      static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+      for (int k = 0; k < 22; ++k) buf[k] = b64[(k < 11 ? a >> (6 * k) : b >> (6 * (k - 11))) & 63];
+      buf[22] = 0;
+      break;
+    }
+    default:
+      snprintf(buf, sizeof(buf), "%08x-%04x-4%03x-%04x-%012llx", (unsigned)(a >> 32),
+               (unsigned)(a >> 16 & 0xffff), (unsigned)(a & 0xfff),
+               (unsigned)(0x8000 | (b >> 48 & 0x3fff)), (unsigned long long)(b & 0xffffffffffffULL));
+    }
+    return buf;
+  }
+
+  std::string natural() {
+    char buf[512];
+    std::string s;
+    switch (cfg.kind) {
+    case URLS:
+      s = rng.below(4) ? "https://" : "http://";
+      s += host();
+      for (size_t k = 0, n = rng.below(cfg.max_depth + 1); k < n; ++k) s += "/", s += word();
+      if (rng.below(3) == 0) {
+        snprintf(buf, sizeof(buf), "?%s=%llu", pick(keys), (unsigned long long)rng.below(100000));
+        s += buf;
+      }
+      break;
+    case EMAILS:
+      s = pick(names);
+      if (rng.below(2)) s += rng.below(2) ? "." : "_", s += pick(names);
+      if (rng.below(3) == 0) s += std::to_string(rng.below(1000));
+      s += "@";
+      s += host();
+      break;
+    case PATHS:
+      for (size_t k = 0, n = 1 + rng.below(cfg.max_depth ? cfg.max_depth : 1); k < n; ++k)
+        s += "/", s += pick(dirs);
+      s += "/";
+      s += word();
+      s += ".";
+      s += pick(exts);
+      break;
+    case JSON_KEYS:
+      s = pick(keys);
+      if (rng.below(3) == 0) s = std::string(word()) + "_" + s;
+      if (rng.below(4) == 0) s = std::string(pick(keys)) + "." + s;
+      break;
+    case WORDS:
+      s = word();
+      break;
+    case LOGS:
+      snprintf(buf, sizeof(buf), "2024-%02u-%02uT%02u:%02u:%02u.%03uZ %s [%s] %s ",
+               (unsigned)(1 + rng.below(12)), (unsigned)(1 + rng.below(28)), (unsigned)rng.below(24),
+               (unsigned)rng.below(60), (unsigned)rng.below(60), (unsigned)rng.below(1000),
+               pick(levels), pick(components), host().c_str());
+      s = buf;
+      for (size_t n = 1 + rng.below(4); n; --n) s += word(), s += " ";
+      s += id();
+      break;
+    case IDS:
+      s = id();
+      break;
+    default:  // CACHE_KEYS
+      s = std::string(pick(keys)) + ":" + id() + ":" + word();
+    }
+    return s;
+  }
+};
+
+//////////////////////////// printing ////////////////////////////
+
+// Print the size and the first 64 bytes of s in hex to f, then a newline, to report an
+// input that may hold any bytes.
+inline void print_input(FILE *f, const std::string &s) {
+  fprintf(f, " input of %zu bytes:", s.size());
+  for (size_t k = 0; k < s.size() && k < 64; ++k) fprintf(f, " %02x", (unsigned char)s[k]);
+  fprintf(f, "%s\n", s.size() > 64 ? " ..." : "");
+}
+
+//////////////////////////// files ////////////////////////////
+
+// Append strs to f as records, return false on a write error.
+inline bool write_corpus(FILE *f, const std::vector<std::string> &strs) {
+  for (size_t k = 0; k < strs.size(); ++k) {
+    unsigned char hdr[10];
+    size_t h = 0;
+    for (size_t v = strs[k].size(); ; v >>= 7) {
+      hdr[h++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+      if (v <= 0x7f) break;
+    }
+    if (fwrite(hdr, 1, h, f) != h) return false;
+    if (fwrite(strs[k].data(), 1, strs[k].size(), f) != strs[k].size()) return false;
+  }
+  return true;
+}
+
+// Append the records of the file at path to strs, return false if it is not a corpus.
+inline bool read_corpus(const char *path, std::vector<std::string> &strs) {
+  FILE *f = fopen(path, "rb");
+  if (!f) return false;
+  bool ok = true;
+  for (int c; (c = getc(f)) != EOF; ) {
+    size_t len = 0;
+    for (int shift = 0; ; shift += 7) {
+      if (c == EOF || shift > 63) {
+        ok = false;
+        break;
+      }
+      len |= (size_t)(c & 0x7f) << shift;
+      if (!(c & 0x80)) break;
+      c = getc(f);
+    }
+    if (!ok) break;
+    // Read in pieces, so that a corrupt length past the end of the file only costs
+    // about the bytes really left, as for a pipe, whose size is unknown.
+    std::string s;
+    while (ok && s.size() < len) {
+      const size_t at = s.size(), n = len - at < 65536 ? len - at : 65536;
+      s.resize(at + n);
+      ok = fread(&s[at], 1, n, f) == n;
+    }
+    if (!ok) break;
+    strs.push_back(s);
+  }
+  fclose(f);
+  return ok;
+}
+
+} // namespace fss
+
+#endif /* __FSS_CORPUS_H__ */
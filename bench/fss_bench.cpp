@@ -0,0 +1,363 @@
+/* fss_bench - short string compression benchmark.
+
+To compile: g++ -O2 -std=c++17 -I../ext/fpaq0f2 fss_bench.cpp ../ext/fpaq0f2/fpaq0f2.cpp
+            With the submodules checked out, add any of
+              -DFSS_BENCH_SMAZ -I../ext/smaz ../ext/smaz/smaz.c
+              -DFSS_BENCH_SHOCO -I../ext/shoco ../ext/shoco/shoco.c
+              -DFSS_BENCH_UNISHOX -I../ext/unishox ../ext/unishox/unishox1.c
+            (compile the .c files with gcc, or with g++ -x c).
+To run:     fss_bench [-n count] [-r repeats] [-m model] [-p] [-f file]... [kind ...]
+
+Generates count strings of each kind of corpus.h (all of them by default),
+or reads the corpus files written by tools/fss_corpus, and for every codec
+reports, per length bucket, the time per string and the throughput of
+compression and decompression over the uncompressed bytes, and the
+compression ratio (compressed / uncompressed). Every string is checked to
+decompress to itself. The best of repeats runs is reported. The trained
+model is trained on every tenth string of each corpus, or loaded from a
+file saved by tools/fss_train.
+
+With -p, each bucket also runs once more under the hardware counters of
+perf_counters.h, and prints for compression and decompression each counter
+per uncompressed byte and per string: cycles, instructions, L1 data and
+last level cache misses (mostly StateMap lookups), branch misses (mostly
+the coder's bit and renormalization branches) and data TLB misses. A
+counter the system does not provide prints as "-", and with none at all
+-p is ignored.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "corpus.h"
+#include "fpaq0f2.h"
+#include "perf_counters.h"
+
+#ifdef FSS_BENCH_SMAZ
+extern "C" {
+#include "smaz.h"
+}
+#endif
+#ifdef FSS_BENCH_SHOCO
+extern "C" {
+#include "shoco.h"
+}
+#endif
+#ifdef FSS_BENCH_UNISHOX
+extern "C" {
+#include "unishox1.h"
+}
+#endif
+
+//////////////////////////// codecs ////////////////////////////
+
+// Each codec returns the output size, or more than bufsize if it does not fit.
+struct Codec {
+  const char *name;
+  size_t (*compress)(const char *in, size_t len, char *out, size_t bufsize);
+  size_t (*decompress)(const char *in, size_t len, char *out, size_t bufsize);
+};
+
+static fpaq0f2_model *g_model = NULL;  // trained on the corpus being run
+static volatile uint32_t g_hash = 0;   // keeps the fused hashes alive
+
+static size_t adaptive_c(const char *in, size_t len, char *out, size_t bufsize) {
+  return fpaq0f2_compress(in, len, out, bufsize);
+}
+static size_t adaptive_d(const char *in, size_t len, char *out, size_t bufsize) {
+  return fpaq0f2_decompress(in, len, out, bufsize);
+}
+static size_t default_c(const char *in, size_t len, char *out, size_t bufsize) {
+  return fpaq0f2_model_compress(NULL, in, len, out, bufsize);
+}
+static size_t default_d(const char *in, size_t len, char *out, size_t bufsize) {
+  return fpaq0f2_model_decompress(NULL, in, len, out, bufsize);
+}
+static size_t trained_c(const char *in, size_t len, char *out, size_t bufsize) {
+  return fpaq0f2_model_compress(g_model, in, len, out, bufsize);
+}
+static size_t trained_d(const char *in, size_t len, char *out, size_t bufsize) {
+  return fpaq0f2_model_decompress(g_model, in, len, out, bufsize);
+}
+static size_t hash_c(const char *in, size_t len, char *out, size_t bufsize) {
+  uint32_t h;
+  const size_t n = fpaq0f2_model_compress_hash(g_model, in, len, out, bufsize, &h);
+  g_hash = h;
+  return n;
+}
+static size_t hash_d(const char *in, size_t len, char *out, size_t bufsize) {
+  uint32_t h;
+  const size_t n = fpaq0f2_model_decompress_hash(g_model, in, len, out, bufsize, &h);
+  g_hash = h;
+  return n;
+}
+static size_t alphabet_c(const char *in, size_t len, char *out, size_t bufsize) {
+  return fpaq0f2_alphabet_block_compress(in, len, out, bufsize);
+}
+static size_t alphabet_d(const char *in, size_t len, char *out, size_t bufsize) {
+  return fpaq0f2_alphabet_block_decompress(in, len, out, bufsize);
+}
+static size_t token_c(const char *in, size_t len, char *out, size_t bufsize) {
+  return fpaq0f2_token_compress(NULL, in, len, out, bufsize, FPAQ0F2_TOKEN_ALL);
+}
+static size_t token_d(const char *in, size_t len, char *out, size_t bufsize) {
+  return fpaq0f2_token_decompress(NULL, in, len, out, bufsize);
+}
+
+#ifdef FSS_BENCH_SMAZ
+static size_t smaz_c(const char *in, size_t len, char *out, size_t bufsize) {
+  return smaz_compress((char *)in, (int)len, out, (int)bufsize);
+}
+static size_t smaz_d(const char *in, size_t len, char *out, size_t bufsize) {
+  return smaz_decompress((char *)in, (int)len, out, (int)bufsize);
+}
+#endif
+#ifdef FSS_BENCH_SHOCO
+static size_t shoco_c(const char *in, size_t len, char *out, size_t bufsize) {
+  return shoco_compress(in, len, out, bufsize);
+}
+static size_t shoco_d(const char *in, size_t len, char *out, size_t bufsize) {
+  return shoco_decompress(in, len, out, bufsize);
+}
+#endif
+#ifdef FSS_BENCH_UNISHOX
+// unishox has no bound on the output, the buffers are large enough for the corpora.
+static size_t unishox_c(const char *in, size_t len, char *out, size_t) {
+  return unishox1_compress_simple(in, (int)len, out);
+}
+static size_t unishox_d(const char *in, size_t len, char *out, size_t) {
+  return unishox1_decompress_simple(in, (int)len, out);
+}
+#endif
+
+static const Codec codecs[] = {
+  {"fpaq0f2", adaptive_c, adaptive_d},
+  {"fpaq0f2-default", default_c, default_d},
+  {"fpaq0f2-trained", trained_c, trained_d},
+  {"fpaq0f2-trained+crc", hash_c, hash_d},
+  {"fpaq0f2-alphabet", alphabet_c, alphabet_d},
+  {"fpaq0f2-token", token_c, token_d},
+#ifdef FSS_BENCH_SMAZ
+  {"smaz", smaz_c, smaz_d},
+#endif
+#ifdef FSS_BENCH_SHOCO
+  {"shoco", shoco_c, shoco_d},
+#endif
+#ifdef FSS_BENCH_UNISHOX
+  {"unishox", unishox_c, unishox_d},
+#endif
+};
+
+//////////////////////////// main ////////////////////////////
+
+static const size_t MAX_LEN = 1024;     // longer strings are cut
+static const size_t BUF_SIZE = 8 * MAX_LEN;
+
+struct Bucket {
+  size_t lo, hi;  // lengths in [lo, hi]
+};
+
+static const Bucket buckets[] = {
+  {0, 8}, {9, 16}, {17, 32}, {33, 64}, {65, 128}, {129, MAX_LEN},
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point t) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+}
+
+static fss::Counters *g_counters = NULL;  // with -p
+
+// Print the counts of one pass over strings of raw bytes, per byte and per string.
+static void print_counters(const char *what, size_t strings, size_t raw) {
+  printf("  %-20s %-9s", "", what);
+  for (int k = 0; k < fss::COUNTER_COUNT; ++k) {
+    if (!g_counters->available((fss::Counter)k)) {
+      printf(" %9s %9s", "-", "-");
+      continue;
+    }
+    const double v = g_counters->get((fss::Counter)k);
+    printf(" %9.3f %9.1f", raw ? v / raw : 0.0, v / strings);
+  }
+  printf("\n");
+}
+
+// Run one codec over the strings, return false if any does not round trip.
+static bool run(const Codec &c, const std::vector<std::string> &strs, int repeats) {
+  const size_t nb = sizeof(buckets) / sizeof(buckets[0]);
+  for (size_t b = 0; b < nb; ++b) {
+    std::vector<const std::string *> in;
+    size_t raw = 0;
+    for (size_t k = 0; k < strs.size(); ++k)
+      if (strs[k].size() >= buckets[b].lo && strs[k].size() <= buckets[b].hi)
+        in.push_back(&strs[k]), raw += strs[k].size();
+    if (in.empty()) continue;
+
+    // Compressed strings back to back, the k-th at off[k].
+    std::vector<char> packed(2 * raw + BUF_SIZE);
+    std::vector<size_t> off(in.size() + 1);
+    auto compress_all = [&]() {
+      size_t o = 0;
+      for (size_t k = 0; k < in.size(); ++k) {
+        off[k] = o;
+        if (packed.size() - o < BUF_SIZE) packed.resize(packed.size() * 2);
+        const size_t n = c.compress(in[k]->data(), in[k]->size(), &packed[o], BUF_SIZE);
+        if (n > BUF_SIZE) {
+          fprintf(stderr, "%s: compress failed on an", c.name);
+          fss::print_input(stderr, *in[k]);
+          return false;
+        }
+        o += n;
+      }
+      off[in.size()] = o;
+      return true;
+    };
+    double ct = 1e30, dt = 1e30;
+    for (int r = 0; r < repeats; ++r) {
+      std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+      if (!compress_all()) return false;
+      const double s = seconds_since(t);
+      if (s < ct) ct = s;
+    }
+
+    char out[BUF_SIZE];
+    auto decompress_all = [&](bool check) {
+      for (size_t k = 0; k < in.size(); ++k) {
+        const size_t n = c.decompress(&packed[off[k]], off[k+1] - off[k], out, sizeof(out));
+        if (check && (n != in[k]->size() || memcmp(out, in[k]->data(), n))) {
+          fprintf(stderr, "%s: does not round trip an", c.name);
+          fss::print_input(stderr, *in[k]);
+          return false;
+        }
+      }
+      return true;
+    };
+    for (int r = 0; r < repeats; ++r) {
+      std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+      if (!decompress_all(r == 0)) return false;
+      const double s = seconds_since(t);
+      if (s < dt) dt = s;
+    }
+
+    char range[32];
+    snprintf(range, sizeof(range), "%zu-%zu", buckets[b].lo, buckets[b].hi);
+    printf("  %-20s %-9s %8zu %9.1f %9.1f %9.2f %9.2f %7.3f\n", c.name, range, in.size(),
+           ct * 1e9 / in.size(), dt * 1e9 / in.size(), raw / ct / 1e6, raw / dt / 1e6,
+           (double)off[in.size()] / raw);
+
+    // One more pass of each under the counters, apart from the timed ones.
+    if (g_counters) {
+      g_counters->start();
+      compress_all();
+      g_counters->stop();
+      print_counters("c counts", in.size(), raw);
+      g_counters->start();
+      decompress_all(false);
+      g_counters->stop();
+      print_counters("d counts", in.size(), raw);
+    }
+  }
+  return true;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: fss_bench [-n count] [-r repeats] [-m model] [-p] [-f file]... [kind ...]\nkinds:");
+  for (size_t k = 0; k < fss::KIND_COUNT; ++k) fprintf(stderr, " %s", fss::kind_names[k]);
+  fprintf(stderr, "\n");
+  exit(2);
+}
+
+// A corpus to run: generated, or read from a file.
+struct Corpus {
+  std::string name;
+  std::vector<std::string> strs;
+};
+
+int main(int argc, char **argv) {
+  size_t count = 10000;
+  int repeats = 3;
+  const char *model_path = NULL;
+  std::vector<Corpus> corpora;
+  std::vector<int> kinds;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      count = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+      repeats = atoi(argv[++i]);
+      if (repeats < 1) usage();
+    } else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+      model_path = argv[++i];
+    } else if (!strcmp(argv[i], "-p")) {
+      if (!g_counters) g_counters = new fss::Counters;
+      if (!g_counters->any()) {
+        fprintf(stderr, "fss_bench: no hardware counters available, ignoring -p\n");
+        delete g_counters;
+        g_counters = NULL;
+      }
+    } else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+      Corpus c;
+      c.name = argv[++i];
+      if (!fss::read_corpus(argv[i], c.strs)) fprintf(stderr, "%s: not a corpus\n", argv[i]), exit(1);
+      corpora.push_back(c);
+    } else {
+      int k = 0;
+      while (k < fss::KIND_COUNT && strcmp(argv[i], fss::kind_names[k])) ++k;
+      if (k == fss::KIND_COUNT) usage();
+      kinds.push_back(k);
+    }
+  }
+  if (corpora.empty() && kinds.empty())
+    for (int k = 0; k < fss::KIND_COUNT; ++k) kinds.push_back(k);
+  for (size_t k = 0; k < kinds.size(); ++k) {
+    fss::Config cfg;
+    cfg.kind = (fss::Kind)kinds[k];
+    fss::Generator gen(cfg);
+    Corpus c;
+    c.name = fss::kind_names[kinds[k]];
+    for (size_t n = 0; n < count; ++n) c.strs.push_back(gen.next());
+    corpora.push_back(c);
+  }
+  if (model_path && !(g_model = fpaq0f2_model_load_file(model_path)))
+    fprintf(stderr, "%s: not a readable model file\n", model_path), exit(1);
+
+  bool ok = true;
+  for (size_t s = 0; s < corpora.size(); ++s) {
+    std::vector<std::string> &strs = corpora[s].strs;
+    for (size_t k = 0; k < strs.size(); ++k)
+      if (strs[k].size() > MAX_LEN) strs[k].resize(MAX_LEN);
+
+    // Train on every tenth string, as a deployment trains on a sample.
+    if (!model_path) {
+      std::string samples;
+      std::vector<size_t> lens;
+      for (size_t k = 0; k < strs.size(); k += 10) {
+        samples += strs[k];
+        lens.push_back(strs[k].size());
+      }
+      fpaq0f2_model_free(g_model);
+      g_model = fpaq0f2_model_train(samples.data(), lens.data(), lens.size());
+      if (!g_model) fprintf(stderr, "out of memory\n"), exit(1);
+    }
+
+    printf("%s: %zu strings\n", corpora[s].name.c_str(), strs.size());
+    printf("  %-20s %-9s %8s %9s %9s %9s %9s %7s\n", "codec", "length", "strings", "c ns/str",
+           "d ns/str", "c MB/s", "d MB/s", "ratio");
+    if (g_counters) {
+      printf("  %-20s %-9s", "", "");
+      for (int k = 0; k < fss::COUNTER_COUNT; ++k) printf(" %19s", fss::counter_names[k]);
+      printf("\n  %-20s %-9s", "", "");
+      for (int k = 0; k < fss::COUNTER_COUNT; ++k) printf(" %9s %9s", "/byte", "/str");
+      printf("\n");
+    }
+    for (size_t c = 0; c < sizeof(codecs) / sizeof(codecs[0]); ++c)
+      ok = run(codecs[c], strs, repeats) && ok;
+  }
+  fpaq0f2_model_free(g_model);
+  delete g_counters;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,216 @@
+/* fss_latency - per call latency of short string compression.
+
+To compile: g++ -O2 -std=c++17 -I../ext/fpaq0f2 fss_latency.cpp ../ext/fpaq0f2/fpaq0f2.cpp
+To run:     fss_latency [-n count] [-w calls] [-c calls] [-e MB] [-m model] [-f file]... [kind ...]
+
+Times every single call of compression and decompression, through each API
+of apis.h:
+  one-shot  fpaq0f2_compress(), which allocates and initializes a 256 KB
+            model on every call
+  context   fpaq0f2_ctx_compress() with one fpaq0f2_ctx reused by all calls
+  frozen    fpaq0f2_model_compress() with a model trained on every tenth
+            string of the corpus, or loaded from a file saved by
+            tools/fss_train
+and records the times in a histogram per API and length bucket, for warm and
+cold caches. Warm runs -w calls (default 20000) back to back over the
+strings of a bucket after a pass to warm up. Cold runs -c calls (default
+300) and before each one evicts the caches and the TLB by writing -e MB
+(default 32, more than the last level cache). For both, p50, p99, p999 and
+the maximum are reported in nanoseconds, which include about 20 ns of
+clock reads. A p999 is only meaningful over several thousand calls.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "apis.h"
+#include "corpus.h"
+#include "fpaq0f2.h"
+#include "histogram.h"
+
+static fpaq0f2_ctx *g_ctx = NULL;
+static fpaq0f2_model *g_model = NULL;  // trained on the corpus being run
+
+//////////////////////////// main ////////////////////////////
+
+static const size_t MAX_LEN = 1024;     // longer strings are cut
+static const size_t BUF_SIZE = 8 * MAX_LEN;
+
+struct Bucket {
+  size_t lo, hi;  // lengths in [lo, hi]
+};
+
+static const Bucket buckets[] = {
+  {0, 8}, {9, 16}, {17, 32}, {33, 64}, {65, 128}, {129, MAX_LEN},
+};
+
+static std::vector<unsigned char> g_evict;
+
+// Push the caches and the TLB out by writing every line of a buffer larger than them.
+static void evict() {
+  for (size_t k = 0; k < g_evict.size(); k += 64) ++g_evict[k];
+}
+
+static uint64_t nanos(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b) {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(b - a).count();
+}
+
+static void print(const char *api, const char *range, const char *state, const fss::Histogram &c,
+                  const fss::Histogram &d) {
+  printf("  %-9s %-9s %-5s %7llu %8llu %8llu %8llu %8llu %8llu %8llu %8llu %8llu\n", api, range, state,
+         (unsigned long long)c.size(),
+         (unsigned long long)c.quantile(0.5), (unsigned long long)c.quantile(0.99),
+         (unsigned long long)c.quantile(0.999), (unsigned long long)c.max(),
+         (unsigned long long)d.quantile(0.5), (unsigned long long)d.quantile(0.99),
+         (unsigned long long)d.quantile(0.999), (unsigned long long)d.max());
+}
+
+// Time one API over the strings, return false if any does not round trip.
+static bool run(const fss::Api &a, const std::vector<std::string> &strs, size_t warm_calls, size_t cold_calls) {
+  const size_t nb = sizeof(buckets) / sizeof(buckets[0]);
+  std::vector<char> out(BUF_SIZE);
+  for (size_t b = 0; b < nb; ++b) {
+    std::vector<const std::string *> in;
+    for (size_t k = 0; k < strs.size(); ++k)
+      if (strs[k].size() >= buckets[b].lo && strs[k].size() <= buckets[b].hi) in.push_back(&strs[k]);
+    if (in.empty()) continue;
+
+    // Compress each string once, check it, and warm up.
+    std::vector<std::string> packed(in.size());
+    for (size_t k = 0; k < in.size(); ++k) {
+      const size_t n = a.compress(g_ctx, g_model, in[k]->data(), in[k]->size(), &out[0], BUF_SIZE);
+      if (n > BUF_SIZE) {
+        fprintf(stderr, "%s: compress failed on an", a.name);
+        fss::print_input(stderr, *in[k]);
+        return false;
+      }
+      packed[k].assign(&out[0], n);
+      const size_t m = a.decompress(g_ctx, g_model, packed[k].data(), n, &out[0], BUF_SIZE);
+      if (m != in[k]->size() || memcmp(&out[0], in[k]->data(), m)) {
+        fprintf(stderr, "%s: does not round trip an", a.name);
+        fss::print_input(stderr, *in[k]);
+        return false;
+      }
+    }
+
+    char range[32];
+    snprintf(range, sizeof(range), "%zu-%zu", buckets[b].lo, buckets[b].hi);
+    fss::Histogram c, d;
+    for (int cold = 0; cold < 2; ++cold) {
+      c.clear();
+      d.clear();
+      const size_t calls = cold ? cold_calls : warm_calls;
+      for (size_t i = 0; i < calls; ++i) {
+        const size_t k = i % in.size();
+        if (cold) evict();
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        a.compress(g_ctx, g_model, in[k]->data(), in[k]->size(), &out[0], BUF_SIZE);
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        c.record(nanos(t0, t1));
+
+        if (cold) evict();
+        t0 = std::chrono::steady_clock::now();
+        a.decompress(g_ctx, g_model, packed[k].data(), packed[k].size(), &out[0], BUF_SIZE);
+        t1 = std::chrono::steady_clock::now();
+        d.record(nanos(t0, t1));
+      }
+      if (calls) print(a.name, range, cold ? "cold" : "warm", c, d);
+    }
+  }
+  return true;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: fss_latency [-n count] [-w calls] [-c calls] [-e MB] [-m model] [-f file]... "
+          "[kind ...]\nkinds:");
+  for (size_t k = 0; k < fss::KIND_COUNT; ++k) fprintf(stderr, " %s", fss::kind_names[k]);
+  fprintf(stderr, "\n");
+  exit(2);
+}
+
+// A corpus to run: generated, or read from a file.
+struct Corpus {
+  std::string name;
+  std::vector<std::string> strs;
+};
+
+int main(int argc, char **argv) {
+  size_t count = 10000, warm_calls = 20000, cold_calls = 300, evict_mb = 32;
+  const char *model_path = NULL;
+  std::vector<Corpus> corpora;
+  std::vector<int> kinds;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      count = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+      warm_calls = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+      cold_calls = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+      evict_mb = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+      model_path = argv[++i];
+    } else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+      Corpus c;
+      c.name = argv[++i];
+      if (!fss::read_corpus(argv[i], c.strs)) fprintf(stderr, "%s: not a corpus\n", argv[i]), exit(1);
+      corpora.push_back(c);
+    } else {
+      int k = 0;
+      while (k < fss::KIND_COUNT && strcmp(argv[i], fss::kind_names[k])) ++k;
+      if (k == fss::KIND_COUNT) usage();
+      kinds.push_back(k);
+    }
+  }
+  if (corpora.empty() && kinds.empty())
+    for (int k = 0; k < fss::KIND_COUNT; ++k) kinds.push_back(k);
+  for (size_t k = 0; k < kinds.size(); ++k) {
+    fss::Config cfg;
+    cfg.kind = (fss::Kind)kinds[k];
+    fss::Generator gen(cfg);
+    Corpus c;
+    c.name = fss::kind_names[kinds[k]];
+    for (size_t n = 0; n < count; ++n) c.strs.push_back(gen.next());
+    corpora.push_back(c);
+  }
+  if (model_path && !(g_model = fpaq0f2_model_load_file(model_path)))
+    fprintf(stderr, "%s: not a readable model file\n", model_path), exit(1);
+  g_ctx = fpaq0f2_ctx_new();
+  if (!g_ctx) fprintf(stderr, "out of memory\n"), exit(1);
+  g_evict.assign(evict_mb << 20, 0);
+
+  bool ok = true;
+  for (size_t s = 0; s < corpora.size(); ++s) {
+    std::vector<std::string> &strs = corpora[s].strs;
+    for (size_t k = 0; k < strs.size(); ++k)
+      if (strs[k].size() > MAX_LEN) strs[k].resize(MAX_LEN);
+
+    // Train on every tenth string, as a deployment trains on a sample.
+    if (!model_path) {
+      std::string samples;
+      std::vector<size_t> lens;
+      for (size_t k = 0; k < strs.size(); k += 10) {
+        samples += strs[k];
+        lens.push_back(strs[k].size());
+      }
+      fpaq0f2_model_free(g_model);
+      g_model = fpaq0f2_model_train(samples.data(), lens.data(), lens.size());
+      if (!g_model) fprintf(stderr, "out of memory\n"), exit(1);
+    }
+
+    printf("%s: %zu strings, latency in ns\n", corpora[s].name.c_str(), strs.size());
+    printf("  %-9s %-9s %-5s %7s %8s %8s %8s %8s %8s %8s %8s %8s\n", "api", "length", "cache", "calls",
+           "c p50", "c p99", "c p999", "c max", "d p50", "d p99", "d p999", "d max");
+    for (size_t a = 0; a < fss::API_COUNT; ++a)
+      ok = run(fss::apis[a], strs, warm_calls, cold_calls) && ok;
+  }
+  fpaq0f2_ctx_free(g_ctx);
+  fpaq0f2_model_free(g_model);
+  return ok ? 0 : 1;
+}
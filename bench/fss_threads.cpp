@@ -0,0 +1,243 @@
+/* fss_threads - multi-thread scaling of short string compression.
+
+To compile: g++ -O2 -std=c++17 -pthread -I../ext/fpaq0f2 fss_threads.cpp ../ext/fpaq0f2/fpaq0f2.cpp
+To run:     fss_threads [-n count] [-t threads,...] [-d seconds] [-u] [-m model] [-f file]... [kind ...]
+
+Runs compress, decompress and check calls over one corpus (the strings of
+every kind or file given, urls by default) on 1, 2, 4, ... threads up to
+the CPUs this process may run on, or on 1 thread and then the thread
+counts of -t, each thread pinned to its own CPU unless -u. Each run lasts
+-d seconds (default 1). For each API of apis.h:
+  one-shot  fpaq0f2_compress(), which allocates a 256 KB model per call, so
+            it contends on the allocator and on page faults
+  context   one fpaq0f2_ctx per thread
+  frozen    one model, trained on every tenth string of the corpus or
+            loaded from a file saved by tools/fss_train, shared by all
+            threads
+it reports the total throughput (uncompressed bytes compressed plus those
+decompressed, per second), the calls (a compress, a decompress and a check)
+per second, the speedup over one thread, the efficiency (speedup / threads,
+1 is perfect scaling), and the slowest and fastest thread. Per-thread state
+sits on its own cache lines, so falling efficiency points at the library,
+not at the harness.
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "apis.h"
+#include "corpus.h"
+#include "fpaq0f2.h"
+
+static fpaq0f2_model *g_model = NULL;  // shared by all threads
+
+//////////////////////////// threads ////////////////////////////
+
+static const size_t MAX_LEN = 1024;     // longer strings are cut
+static const size_t BUF_SIZE = 8 * MAX_LEN;
+
+// What one thread does and counts, alone on its cache lines.
+struct alignas(64) Worker {
+  std::thread thread;
+  int cpu;              // to pin to, or -1
+  size_t first;         // index of the first string it codes
+  uint64_t bytes;       // uncompressed bytes compressed and decompressed
+  uint64_t calls;
+  double seconds;
+  bool failed;
+  char out[BUF_SIZE], back[BUF_SIZE];
+};
+
+static std::atomic<bool> g_go(false), g_stop(false);
+static std::atomic<int> g_ready(0);
+
+static void work(Worker *w, const fss::Api *a, const std::vector<std::string> *strs) {
+  if (w->cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+  fpaq0f2_ctx *ctx = fpaq0f2_ctx_new();
+  if (!ctx) fprintf(stderr, "out of memory\n"), exit(1);
+  w->bytes = w->calls = 0;
+  w->failed = false;
+
+  g_ready.fetch_add(1);
+  while (!g_go.load(std::memory_order_acquire)) std::this_thread::yield();
+  std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+  for (size_t k = w->first; !g_stop.load(std::memory_order_relaxed); k = k + 1 < strs->size() ? k + 1 : 0) {
+    const std::string &s = (*strs)[k];
+    const size_t n = a->compress(ctx, g_model, s.data(), s.size(), w->out, BUF_SIZE);
+    const size_t m = n <= BUF_SIZE ? a->decompress(ctx, g_model, w->out, n, w->back, BUF_SIZE) : 0;
+    if (n > BUF_SIZE || m != s.size() || memcmp(w->back, s.data(), m)) {
+      w->failed = true;
+      break;
+    }
+    w->bytes += 2 * s.size();
+    ++w->calls;
+  }
+  w->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+  fpaq0f2_ctx_free(ctx);
+}
+
+// Run one API on n threads for some seconds, return the total MB/s, or -1 on a failure.
+// The speedup is over base MB/s, or 1 for the baseline run itself (base 0), and "-"
+// if the baseline failed (base < 0).
+static double run(const fss::Api &a, const std::vector<std::string> &strs, size_t n, double seconds,
+                  const std::vector<int> &cpus, double base) {
+  std::vector<Worker> workers(n);
+  g_go = false;
+  g_stop = false;
+  g_ready = 0;
+  for (size_t i = 0; i < n; ++i) {
+    Worker &w = workers[i];
+    w.cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+    w.first = strs.size() * i / n;
+    w.thread = std::thread(work, &w, &a, &strs);
+  }
+  while (g_ready.load() < (int)n) std::this_thread::yield();
+  g_go.store(true, std::memory_order_release);
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  g_stop.store(true, std::memory_order_relaxed);
+
+  double total = 0, lo = 1e30, hi = 0;
+  uint64_t calls = 0;
+  bool failed = false;
+  for (size_t i = 0; i < n; ++i) {
+    Worker &w = workers[i];
+    w.thread.join();
+    failed = failed || w.failed;
+    const double mbs = w.seconds > 0 ? w.bytes / w.seconds / 1e6 : 0;
+    total += mbs;
+    calls += w.calls;
+    if (mbs < lo) lo = mbs;
+    if (mbs > hi) hi = mbs;
+  }
+  if (failed) {
+    fprintf(stderr, "%s: a string does not round trip on %zu threads\n", a.name, n);
+    return -1;
+  }
+  char speedup[16] = "-", eff[16] = "-";
+  if (base >= 0) {
+    snprintf(speedup, sizeof(speedup), "%.2f", base > 0 ? total / base : 1);
+    snprintf(eff, sizeof(eff), "%.2f", (base > 0 ? total / base : 1) / n);
+  }
+  printf("  %-9s %7zu %9.2f %9.3f %8s %6s %9.2f %9.2f\n", a.name, n, total, calls / seconds / 1e6, speedup,
+         eff, lo, hi);
+  return total;
+}
+
+//////////////////////////// main ////////////////////////////
+
+static void usage() {
+  fprintf(stderr, "usage: fss_threads [-n count] [-t threads,...] [-d seconds] [-u] [-m model] "
+          "[-f file]... [kind ...]\nkinds:");
+  for (size_t k = 0; k < fss::KIND_COUNT; ++k) fprintf(stderr, " %s", fss::kind_names[k]);
+  fprintf(stderr, "\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  size_t count = 10000;
+  double seconds = 1;
+  bool pin = true;
+  const char *model_path = NULL;
+  std::vector<size_t> threads;
+  std::vector<std::string> strs;
+  std::vector<int> kinds;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      count = strtoul(argv[++i], NULL, 10);
+    } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+      for (char *p = argv[++i]; *p; ) {
+        const size_t t = strtoul(p, &p, 10);
+        if (t < 1) usage();
+        threads.push_back(t);
+        if (*p == ',') ++p;
+        else if (*p) usage();
+      }
+    } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+      seconds = atof(argv[++i]);
+      if (seconds <= 0) usage();
+    } else if (!strcmp(argv[i], "-u")) {
+      pin = false;
+    } else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+      model_path = argv[++i];
+    } else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+      if (!fss::read_corpus(argv[++i], strs)) fprintf(stderr, "%s: not a corpus\n", argv[i]), exit(1);
+    } else {
+      int k = 0;
+      while (k < fss::KIND_COUNT && strcmp(argv[i], fss::kind_names[k])) ++k;
+      if (k == fss::KIND_COUNT) usage();
+      kinds.push_back(k);
+    }
+  }
+  if (strs.empty() && kinds.empty()) kinds.push_back(fss::URLS);
+  for (size_t k = 0; k < kinds.size(); ++k) {
+    fss::Config cfg;
+    cfg.kind = (fss::Kind)kinds[k];
+    fss::Generator gen(cfg);
+    for (size_t n = 0; n < count; ++n) strs.push_back(gen.next());
+  }
+  if (strs.empty()) fprintf(stderr, "no strings\n"), exit(1);
+  for (size_t k = 0; k < strs.size(); ++k)
+    if (strs[k].size() > MAX_LEN) strs[k].resize(MAX_LEN);
+
+  // The CPUs this process may run on, one per thread in turn.
+  std::vector<int> cpus;
+  cpu_set_t set;
+  if (0 == sched_getaffinity(0, sizeof(set), &set))
+    for (int c = 0; c < CPU_SETSIZE; ++c)
+      if (CPU_ISSET(c, &set)) cpus.push_back(c);
+  const size_t ncpus = cpus.empty() ? std::thread::hardware_concurrency() : cpus.size();
+  if (!pin) cpus.clear();
+  if (threads.empty()) {
+    for (size_t t = 1; t < ncpus; t *= 2) threads.push_back(t);
+    threads.push_back(ncpus ? ncpus : 1);
+  }
+  // 1 thread first, the baseline of the speedups.
+  threads.erase(std::remove(threads.begin(), threads.end(), 1), threads.end());
+  threads.insert(threads.begin(), 1);
+
+  if (model_path) {
+    g_model = fpaq0f2_model_load_file(model_path);
+    if (!g_model) fprintf(stderr, "%s: not a readable model file\n", model_path), exit(1);
+  } else {
+    std::string samples;
+    std::vector<size_t> lens;
+    for (size_t k = 0; k < strs.size(); k += 10) {
+      samples += strs[k];
+      lens.push_back(strs[k].size());
+    }
+    g_model = fpaq0f2_model_train(samples.data(), lens.data(), lens.size());
+    if (!g_model) fprintf(stderr, "out of memory\n"), exit(1);
+  }
+
+  printf("%zu strings, %zu CPUs, %s, %g s per run\n", strs.size(), ncpus, pin ? "pinned" : "not pinned",
+         seconds);
+  printf("  %-9s %7s %9s %9s %8s %6s %9s %9s\n", "api", "threads", "MB/s", "Mcalls/s", "speedup", "eff",
+         "min MB/s", "max MB/s");
+  bool ok = true;
+  for (size_t a = 0; a < fss::API_COUNT; ++a) {
+    double base = 0;
+    for (size_t t = 0; t < threads.size(); ++t) {
+      const double mbs = run(fss::apis[a], strs, threads[t], seconds, cpus, base);
+      if (mbs < 0) ok = false;
+      if (t == 0) base = mbs;
+    }
+  }
+  fpaq0f2_model_free(g_model);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,254 @@
+/* orig_compare - check the library coder against the original fpaq0f2.
+
+To compile: g++ -O2 -std=c++17 -I. -I../ext/fpaq0f2 orig_compare.cpp ../ext/fpaq0f2/fpaq0f2.cpp
+To run:     orig_compare [-n count] [-s seed]
+
+Builds ext/fpaq0f2/fpaq0f2-orig.cpp, the original file based compressor,
+into this program in its own namespace, and checks over the corpora of
+corpus.h and over random inputs that fpaq0f2_compress() writes exactly the
+bytes the original writes, and that each side decompresses the other's
+output. Then reports the throughput of both, for whole corpora and for
+single strings. Exits 1 on the first difference, so a change to the coder
+can be gated on it.
+*/
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "corpus.h"
+#include "fpaq0f2.h"
+
+// The original never frees the table of its StateMap, a leak of 256 KB per
+// coder that its main() can afford. Its calloc() calls are recorded here
+// instead, and free_orig_tables() frees them when its coder is gone.
+static std::vector<void *> g_orig_tables;
+
+static void *orig_calloc(size_t n, size_t size) {
+  void *const p = calloc(n, size);
+  if (p) g_orig_tables.push_back(p);
+  return p;
+}
+
+static void free_orig_tables() {
+  for (size_t k = 0; k < g_orig_tables.size(); ++k) free(g_orig_tables[k]);
+  g_orig_tables.clear();
+}
+
+// The original, with its main() renamed. Its headers are already included
+// above, so only its own definitions land in the namespace. It defines
+// NDEBUG itself, which a release build has already.
+#undef NDEBUG
+namespace orig {
+#define main orig_main
+#define calloc orig_calloc
+#include "fpaq0f2-orig.cpp"
+#undef calloc
+#undef main
+}
+#undef NDEBUG
+
+//////////////////////////// coders ////////////////////////////
+
+// Compress with the original Encoder, as its main() does, to a memory stream.
+static std::string orig_compress(const std::string &in) {
+  char *buf = NULL;
+  size_t size = 0;
+  FILE *out = open_memstream(&buf, &size);
+  if (!out) perror("open_memstream"), exit(1);
+  {
+    orig::Encoder e(orig::COMPRESS, out);
+    for (size_t k = 0; k < in.size(); ++k) {
+      const int c = (unsigned char)in[k];
+      e.encode(1);
+      for (int i = 7; i >= 0; --i) e.encode((c >> i) & 1);
+    }
+    e.encode(0);  // EOF code
+    e.flush();
+  }
+  free_orig_tables();
+  fclose(out);
+  std::string s(buf, size);
+  free(buf);
+  return s;
+}
+
+static std::string orig_decompress(const std::string &in) {
+  // fmemopen() rejects a zero size buffer, pad it; the padding is never read as data.
+  std::string padded = in + '\0';
+  FILE *f = fmemopen(&padded[0], in.size() ? in.size() : 1, "rb");
+  if (!f) perror("fmemopen"), exit(1);
+  std::string s;
+  {
+    orig::Encoder e(orig::DECOMPRESS, f);
+    while (e.decode()) {
+      int c = 1;
+      while (c < 256) c += c + e.decode();
+      s += (char)(c - 256);
+    }
+  }
+  free_orig_tables();
+  fclose(f);
+  return s;
+}
+
+static std::string lib_compress(const std::string &in) {
+  std::string s(in.size() * 2 + 64, '\0');
+  for (;;) {
+    const size_t n = fpaq0f2_compress(in.data(), in.size(), &s[0], s.size());
+    if (n == SIZE_MAX) fprintf(stderr, "fpaq0f2_compress failed\n"), exit(1);
+    if (n <= s.size()) {
+      s.resize(n);
+      return s;
+    }
+    s.resize(s.size() * 2);
+  }
+}
+
+static std::string lib_decompress(const std::string &in, size_t len) {
+  std::string s(len + 1, '\0');
+  const size_t n = fpaq0f2_decompress(in.data(), in.size(), &s[0], s.size());
+  if (n > len) return "<" + std::to_string(n) + ">";  // wrong length or error
+  s.resize(n);
+  return s;
+}
+
+//////////////////////////// checks ////////////////////////////
+
+static size_t g_checked = 0;
+
+static void check(const std::string &in, const char *what) {
+  const std::string a = orig_compress(in), b = lib_compress(in);
+  const char *failed = NULL;
+  if (a != b) failed = "compressed bytes differ";
+  else if (orig_decompress(b) != in) failed = "the original does not decompress the library's output";
+  else if (lib_decompress(a, in.size()) != in) failed = "the library does not decompress the original's output";
+  if (failed) {
+    fprintf(stderr, "%s: %s, input of %zu bytes:", what, failed, in.size());
+    for (size_t k = 0; k < in.size() && k < 64; ++k) fprintf(stderr, " %02x", (unsigned char)in[k]);
+    fprintf(stderr, "%s\n", in.size() > 64 ? " ..." : "");
+    exit(1);
+  }
+  ++g_checked;
+}
+
+// Run the original program itself once, through files, as a user would.
+static void check_program(const std::string &in) {
+  char src[] = "/tmp/orig_compareXXXXXX", dst[] = "/tmp/orig_compareXXXXXX";
+  const int fs = mkstemp(src), fd = mkstemp(dst);
+  if (fs < 0 || fd < 0) perror("mkstemp"), exit(1);
+  if (write(fs, in.data(), in.size()) != (ssize_t)in.size()) perror(src), exit(1);
+  close(fs);
+  close(fd);
+
+  char prog[] = "fpaq0f2", mode[] = "c";
+  char *argv[] = {prog, mode, src, dst, NULL};
+  orig::orig_main(4, argv);
+  free_orig_tables();
+  fflush(NULL);  // it leaves its files open for exit() to flush
+
+  std::string out;
+  FILE *f = fopen(dst, "rb");
+  if (!f) perror(dst), exit(1);
+  for (int c; (c = getc(f)) != EOF; ) out += (char)c;
+  fclose(f);
+  unlink(src);
+  unlink(dst);
+  if (out != lib_compress(in)) fprintf(stderr, "the original program's output differs\n"), exit(1);
+}
+
+//////////////////////////// speed ////////////////////////////
+
+static double seconds(std::chrono::steady_clock::time_point t) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+}
+
+template <class F>
+static double best_of(int runs, F f) {
+  double best = 1e30;
+  for (int r = 0; r < runs; ++r) {
+    std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+    f();
+    const double s = seconds(t);
+    if (s < best) best = s;
+  }
+  return best;
+}
+
+static void speed(const char *name, const std::vector<std::string> &strs) {
+  std::string whole;
+  for (size_t k = 0; k < strs.size(); ++k) whole += strs[k];
+  const std::string packed = lib_compress(whole);
+  const size_t singles = strs.size() < 1000 ? strs.size() : 1000;
+
+  size_t sink = 0;
+  const double oc = best_of(3, [&] { sink += orig_compress(whole).size(); });
+  const double lc = best_of(3, [&] { sink += lib_compress(whole).size(); });
+  const double od = best_of(3, [&] { sink += orig_decompress(packed).size(); });
+  const double ld = best_of(3, [&] { sink += lib_decompress(packed, whole.size()).size(); });
+  const double os = best_of(3, [&] { for (size_t k = 0; k < singles; ++k) sink += orig_compress(strs[k]).size(); });
+  const double ls = best_of(3, [&] { for (size_t k = 0; k < singles; ++k) sink += lib_compress(strs[k]).size(); });
+  const double mb = whole.size() / 1e6;
+  printf("%-12s %8.2f %8.2f %8.2f %8.2f %10.1f %10.1f%s\n", name, mb / oc, mb / lc, mb / od, mb / ld,
+         os * 1e6 / singles, ls * 1e6 / singles, sink ? "" : " ");
+}
+
+//////////////////////////// main ////////////////////////////
+
+int main(int argc, char **argv) {
+  size_t count = 2000;
+  uint64_t seed = 1;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "-n")) count = strtoul(argv[i + 1], NULL, 10);
+    else if (!strcmp(argv[i], "-s")) seed = strtoull(argv[i + 1], NULL, 10);
+    else fprintf(stderr, "usage: orig_compare [-n count] [-s seed]\n"), exit(2);
+  }
+
+  std::vector<std::vector<std::string> > corpora(fss::KIND_COUNT);
+  for (int k = 0; k < fss::KIND_COUNT; ++k) {
+    fss::Config cfg;
+    cfg.kind = (fss::Kind)k;
+    cfg.seed = seed;
+    cfg.utf8_per_mille = k == fss::WORDS ? 100 : 0;
+    fss::Generator gen(cfg);
+    std::string whole;
+    for (size_t n = 0; n < count; ++n) {
+      corpora[k].push_back(gen.next());
+      check(corpora[k].back(), fss::kind_names[k]);
+      whole += corpora[k].back();
+    }
+    check(whole, fss::kind_names[k]);
+  }
+
+  // Random inputs: every byte value, skewed bytes, runs, and the lengths around
+  // the coder's 4 byte window.
+  fss::Rng rng(seed);
+  for (size_t n = 0; n < count; ++n) {
+    std::string s(n < 16 ? n : rng.below(4096), '\0');
+    const int mode = rng.below(4);
+    for (size_t k = 0; k < s.size(); ++k) {
+      if (mode == 0) s[k] = (char)rng.next();
+      else if (mode == 1) s[k] = (char)(rng.below(4) ? 0 : 255);
+      else if (mode == 2) s[k] = (char)("ab"[rng.below(2)]);
+      else s[k] = (char)(k / (1 + rng.below(64)));
+    }
+    check(s, "random");
+  }
+
+  check_program(std::string("check the original program itself, through files\n") + corpora[0][0]);
+  printf("%zu inputs compress to the same bytes as the original\n\n", g_checked);
+
+  printf("%-12s %8s %8s %8s %8s %10s %10s\n", "corpus", "orig c", "lib c", "orig d", "lib d",
+         "orig us/s", "lib us/s");
+  printf("%-12s %8s %8s %8s %8s %10s %10s\n", "", "MB/s", "MB/s", "MB/s", "MB/s", "string", "string");
+  for (int k = 0; k < fss::KIND_COUNT; ++k) speed(fss::kind_names[k], corpora[k]);
+  return 0;
+}
@@ -0,0 +1,118 @@
+#ifndef __FSS_PERF_COUNTERS_H__
+#define __FSS_PERF_COUNTERS_H__
+
+/* Hardware counters for the benchmarks, from perf_event_open(2).
+ *
+ * Counters counts the cycles, instructions, L1 data cache read misses, last level
+ * cache read misses, branch misses and data TLB read misses of the calling thread, in
+ * user space only, so it works with the default perf_event_paranoid of 2. Each counter
+ * is opened on its own: one the CPU, the kernel or a container does not provide is
+ * missing and the others still count. When the kernel multiplexes counters, the counts
+ * are scaled by the time each one ran. Off Linux no counter is available.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace fss {
+
+enum Counter { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCH_MISSES, DTLB_MISSES, COUNTER_COUNT };
+
+static const char *const counter_names[COUNTER_COUNT] = {
+  "cycles", "instructions", "L1d-misses", "LLC-misses", "branch-misses", "dTLB-misses",
+};
+
+class Counters {
+public:
+  Counters() {
+    for (int k = 0; k < COUNTER_COUNT; ++k) fd[k] = -1, value[k] = 0;
+#ifdef __linux__
+    static const struct { uint32_t type; uint64_t config; } events[COUNTER_COUNT] = {
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+      {PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_L1D)},
+      {PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_LL)},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+      {PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_DTLB)},
+    };
+    for (int k = 0; k < COUNTER_COUNT; ++k) {
+      struct perf_event_attr a;
+      memset(&a, 0, sizeof(a));
+      a.size = sizeof(a);
+      a.type = events[k].type;
+      a.config = events[k].config;
+      a.disabled = 1;
+      a.exclude_kernel = 1;
+      a.exclude_hv = 1;
+      a.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      fd[k] = (int)syscall(SYS_perf_event_open, &a, 0, -1, -1, 0);
+    }
+#endif
+  }
+
+  ~Counters() {
+#ifdef __linux__
+    for (int k = 0; k < COUNTER_COUNT; ++k)
+      if (fd[k] >= 0) close(fd[k]);
+#endif
+  }
+
+  bool available(Counter c) const { return fd[c] >= 0; }
+
+  bool any() const {
+    for (int k = 0; k < COUNTER_COUNT; ++k)
+      if (fd[k] >= 0) return true;
+    return false;
+  }
+
+  // Zero the counts and start counting.
+  void start() {
+#ifdef __linux__
+    for (int k = 0; k < COUNTER_COUNT; ++k) {
+      value[k] = 0;
+      if (fd[k] < 0) continue;
+      ioctl(fd[k], PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd[k], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  // Stop counting, the counts are then in get().
+  void stop() {
+#ifdef __linux__
+    for (int k = 0; k < COUNTER_COUNT; ++k) {
+      if (fd[k] < 0) continue;
+      ioctl(fd[k], PERF_EVENT_IOC_DISABLE, 0);
+      uint64_t r[3];  // value, time enabled, time running
+      if (read(fd[k], r, sizeof(r)) != (ssize_t)sizeof(r)) continue;
+      value[k] = r[2] ? (double)r[0] * r[1] / r[2] : 0;
+    }
+#endif
+  }
+
+  double get(Counter c) const { return value[c]; }
+
+private:
+  int fd[COUNTER_COUNT];
+  double value[COUNTER_COUNT];
+
+#ifdef __linux__
+  static uint64_t cache(uint64_t id) {
+    return id | (uint64_t)PERF_COUNT_HW_CACHE_OP_READ << 8 | (uint64_t)PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+  }
+#endif
+
+  Counters(const Counters &);
+  Counters &operator=(const Counters &);
+};
+
+} // namespace fss
+
+#endif /* __FSS_PERF_COUNTERS_H__ */
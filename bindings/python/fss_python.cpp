@@ -0,0 +1,461 @@
+/* fss_python - Python bindings coding whole columns of short strings at once.
+
+To compile: cd bindings/python && pip install .   (or build the fss_python target of CMake)
+To use:
+    import fss
+    model = fss.train(data, offsets)
+    cdata, coffsets = fss.compress(data, offsets, model, threads=4)
+    data2, offsets2 = fss.decompress(cdata, coffsets, model, threads=4)
+
+A column is given Arrow style, as a data buffer holding its values back to
+back and an offsets buffer of n + 1 integers, value k being
+data[offsets[k]:offsets[k + 1]]: any objects with the buffer protocol, such
+as the buffers of a pyarrow binary or string array, numpy arrays, bytes or
+array.array. Offsets are 32 or 64 bit integers, and the offsets returned
+have the same width and start at 0. Null values are simply empty.
+
+compress(data, offsets, model=None, threads=1) and decompress(...) code each
+value as fpaq0f2_model_compress() with a frozen model, or as
+fpaq0f2_compress() without one, and return (data, offsets) as two read-only
+fss.Buffer objects, which numpy.frombuffer() and pyarrow.py_buffer() wrap
+without copying. train(data, offsets) returns an fss.Model trained on the
+values, Model(saved) loads one saved by Model.save() or tools/fss_train,
+Model.id is its id, and default_model() is the built-in one.
+
+No Python object is made per value. The GIL is released while coding and
+training, and threads > 1 splits the column into that many runs of values
+coded in parallel, each thread with its own fpaq0f2_ctx, but no more runs
+than there are hardware threads. threads is at most 1024, as for tools/fss.
+Python 3.10 or later is needed.
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "fpaq0f2.h"
+
+//////////////////////////// Buffer ////////////////////////////
+
+// A read-only buffer of bytes, or of 32 or 64 bit integers, owning a vector.
+struct Buffer {
+  PyObject_HEAD
+  std::vector<char> *bytes;
+  const char *format;  // "B", "i" or "q"
+  Py_ssize_t shape[1], strides[1];
+};
+
+static PyObject *g_buffer_type = NULL;
+static PyObject *g_model_type = NULL;
+
+// Wrap bytes, which the buffer takes over, as items of format.
+static PyObject *new_buffer(std::vector<char> &bytes, const char *format) {
+  Buffer *const b = PyObject_New(Buffer, (PyTypeObject *)g_buffer_type);
+  if (!b) return NULL;
+  b->bytes = new (std::nothrow) std::vector<char>();
+  if (!b->bytes) {
+    Py_DECREF(b);
+    return PyErr_NoMemory();
+  }
+  b->bytes->swap(bytes);
+  b->format = format;
+  b->strides[0] = format[0] == 'B' ? 1 : format[0] == 'i' ? 4 : 8;
+  b->shape[0] = b->bytes->size() / b->strides[0];
+  return (PyObject *)b;
+}
+
+static void buffer_dealloc(PyObject *self) {
+  delete ((Buffer *)self)->bytes;
+  PyTypeObject *const type = Py_TYPE(self);
+  PyObject_Free(self);
+  Py_DECREF(type);
+}
+
+static int buffer_get(PyObject *self, Py_buffer *view, int flags) {
+  Buffer *const b = (Buffer *)self;
+  if (flags & PyBUF_WRITABLE) {
+    PyErr_SetString(PyExc_BufferError, "fss.Buffer is read-only");
+    view->obj = NULL;
+    return -1;
+  }
+  static char empty;
+  view->obj = self;
+  Py_INCREF(self);
+  view->buf = b->bytes->empty() ? &empty : b->bytes->data();
+  view->len = b->bytes->size();
+  view->readonly = 1;
+  view->itemsize = b->strides[0];
+  view->format = flags & PyBUF_FORMAT ? (char *)b->format : NULL;
+  view->ndim = 1;
+  view->shape = flags & PyBUF_ND ? b->shape : NULL;
+  view->strides = flags & PyBUF_STRIDES ? b->strides : NULL;
+  view->suboffsets = NULL;
+  view->internal = NULL;
+  return 0;
+}
+
+static Py_ssize_t buffer_len(PyObject *self) {
+  return ((Buffer *)self)->shape[0];
+}
+
+static PyType_Slot buffer_slots[] = {
+  {Py_tp_doc, (void *)"A read-only buffer of bytes or offsets returned by fss."},
+  {Py_tp_dealloc, (void *)buffer_dealloc},
+  {Py_bf_getbuffer, (void *)buffer_get},
+  {Py_sq_length, (void *)buffer_len},
+  {0, NULL},
+};
+
+static PyType_Spec buffer_spec = {"fss.Buffer", sizeof(Buffer), 0,
+                                  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION, buffer_slots};
+
+//////////////////////////// Model ////////////////////////////
+
+struct Model {
+  PyObject_HEAD
+  fpaq0f2_model *model;
+  bool owned;  // not the built-in one
+};
+
+static PyObject *new_model(fpaq0f2_model *m, bool owned) {
+  Model *const self = PyObject_New(Model, (PyTypeObject *)g_model_type);
+  if (!self) {
+    if (owned) fpaq0f2_model_free(m);
+    return NULL;
+  }
+  self->model = m;
+  self->owned = owned;
+  return (PyObject *)self;
+}
+
+static PyObject *model_new(PyTypeObject *, PyObject *args, PyObject *kw) {
+  static const char *kwlist[] = {"saved", NULL};
+  Py_buffer saved;
+  if (!PyArg_ParseTupleAndKeywords(args, kw, "y*:Model", (char **)kwlist, &saved)) return NULL;
+  fpaq0f2_model *const m = fpaq0f2_model_load(saved.buf, saved.len);
+  PyBuffer_Release(&saved);
+  if (!m) {
+    PyErr_SetString(PyExc_ValueError, "not a saved model");
+    return NULL;
+  }
+  return new_model(m, true);
+}
+
+static void model_dealloc(PyObject *self) {
+  Model *const m = (Model *)self;
+  if (m->owned) fpaq0f2_model_free(m->model);
+  PyTypeObject *const type = Py_TYPE(self);
+  PyObject_Free(self);
+  Py_DECREF(type);
+}
+
+static PyObject *model_save(PyObject *self, PyObject *) {
+  PyObject *const out = PyBytes_FromStringAndSize(NULL, FPAQ0F2_MODEL_SIZE);
+  if (out) fpaq0f2_model_save(((Model *)self)->model, PyBytes_AS_STRING(out), FPAQ0F2_MODEL_SIZE);
+  return out;
+}
+
+static PyObject *model_id(PyObject *self, void *) {
+  return PyLong_FromUnsignedLong(fpaq0f2_model_id(((Model *)self)->model));
+}
+
+static PyMethodDef model_methods[] = {
+  {"save", model_save, METH_NOARGS, "save() -> bytes, the model in its portable form"},
+  {NULL, NULL, 0, NULL},
+};
+
+static PyGetSetDef model_getset[] = {
+  {(char *)"id", model_id, NULL, (char *)"the CRC32C of the model, which names it in frames", NULL},
+  {NULL, NULL, NULL, NULL, NULL},
+};
+
+static PyType_Slot model_slots[] = {
+  {Py_tp_doc, (void *)"Model(saved) loads a frozen model saved by Model.save() or tools/fss_train."},
+  {Py_tp_new, (void *)model_new},
+  {Py_tp_dealloc, (void *)model_dealloc},
+  {Py_tp_methods, model_methods},
+  {Py_tp_getset, model_getset},
+  {0, NULL},
+};
+
+static PyType_Spec model_spec = {"fss.Model", sizeof(Model), 0, Py_TPFLAGS_DEFAULT, model_slots};
+
+//////////////////////////// columns ////////////////////////////
+
+// The data and offsets buffers of a column.
+class Column {
+public:
+  Py_buffer data, offsets;
+  size_t count;  // values
+  int width;     // bytes per offset, 4 or 8
+
+  Column(): count(0), width(0), held(0) {}
+  ~Column() {
+    if (held > 0) PyBuffer_Release(&data);
+    if (held > 1) PyBuffer_Release(&offsets);
+  }
+
+  // Get the buffers and check the offsets. Return false with an exception set.
+  bool get(PyObject *d, PyObject *o) {
+    if (PyObject_GetBuffer(d, &data, PyBUF_SIMPLE)) return false;
+    held = 1;
+    if (PyObject_GetBuffer(o, &offsets, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT)) return false;
+    held = 2;
+    const char *f = offsets.format ? offsets.format : "B";
+    if (*f == '@' || *f == '=' || *f == '<') ++f;
+    width = offsets.itemsize;
+    if (!f[0] || f[1] || !strchr("iIlLqQ", f[0]) || (width != 4 && width != 8) || offsets.len < width) {
+      PyErr_SetString(PyExc_TypeError, "offsets must be at least one 32 or 64 bit integer");
+      return false;
+    }
+    signed_ = f[0] == 'i' || f[0] == 'l' || f[0] == 'q';
+    count = offsets.len / width - 1;
+    for (size_t k = 0; k <= count; ++k) {
+      const int64_t v = at(k);
+      if (v < 0 || v > data.len || (k && v < at(k - 1))) {
+        PyErr_Format(PyExc_ValueError, "offset %zu is out of order or of the data", k);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Offset k, negative if it does not fit.
+  int64_t at(size_t k) const {
+    if (width == 4) {
+      const int32_t v = ((const int32_t *)offsets.buf)[k];
+      return signed_ ? v : (int64_t)(uint32_t)v;
+    }
+    const int64_t v = ((const int64_t *)offsets.buf)[k];
+    return signed_ || v >= 0 ? v : -1;
+  }
+
+  const char *value(size_t k) const { return (const char *)data.buf + at(k); }
+  size_t size(size_t k) const { return at(k + 1) - at(k); }
+
+private:
+  int held;  // buffers to release
+  bool signed_;
+};
+
+// What one thread codes: values [first, last) of a column into data, value k ending at
+// ends[k - first].
+struct Run {
+  size_t first, last;
+  std::vector<char> data;
+  std::vector<uint64_t> ends;
+  size_t failed;  // the value that does not code, or SIZE_MAX
+  bool nomem;
+};
+
+static void code_run(const Column &c, const fpaq0f2_model *model, bool decompress, Run &r) {
+  r.failed = SIZE_MAX;
+  r.nomem = false;
+  fpaq0f2_ctx *const ctx = model ? NULL : fpaq0f2_ctx_new();
+  try {
+    if (!model && !ctx) throw std::bad_alloc();
+    r.ends.reserve(r.last - r.first);
+    for (size_t k = r.first; k < r.last; ++k) {
+      const char *const in = c.value(k);
+      const size_t len = c.size(k);
+      for (size_t room = decompress ? 4 * len + 16 : len + len / 2 + 16; ; room *= 2) {
+        const size_t at = r.data.size();
+        r.data.resize(at + room);
+        char *const out = r.data.data() + at;
+        const size_t n = decompress ? (model ? fpaq0f2_model_decompress(model, in, len, out, room)
+                                             : fpaq0f2_ctx_decompress(ctx, in, len, out, room))
+                                    : (model ? fpaq0f2_model_compress(model, in, len, out, room)
+                                             : fpaq0f2_ctx_compress(ctx, in, len, out, room));
+        r.data.resize(n <= room ? at + n : at);
+        if (n <= room) break;
+        if (n == SIZE_MAX) {
+          r.failed = k;
+          break;
+        }
+      }
+      if (r.failed != SIZE_MAX) break;
+      r.ends.push_back(r.data.size());
+    }
+  } catch (const std::bad_alloc &) {
+    r.nomem = true;
+  }
+  fpaq0f2_ctx_free(ctx);
+}
+
+// Join the runs into the data and offsets of the result, or set an exception.
+static PyObject *join(std::vector<Run> &runs, int width) {
+  size_t total = 0, count = 0;
+  for (size_t i = 0; i < runs.size(); ++i) total += runs[i].data.size(), count += runs[i].ends.size();
+  if (width == 4 && total > INT32_MAX) {
+    PyErr_SetString(PyExc_OverflowError, "the result does not fit 32 bit offsets");
+    return NULL;
+  }
+  std::vector<char> data, offsets;
+  try {
+    offsets.resize((count + 1) * width);
+    if (runs.size() == 1) {
+      data.swap(runs[0].data);
+    } else {
+      data.reserve(total);
+      for (size_t i = 0; i < runs.size(); ++i) data.insert(data.end(), runs[i].data.begin(), runs[i].data.end());
+    }
+  } catch (const std::bad_alloc &) {
+    return PyErr_NoMemory();
+  }
+  char *p = offsets.data() + width;  // offsets[0] is 0
+  for (size_t i = 0, base = 0; i < runs.size(); base += runs[i++].data.size())
+    for (size_t k = 0; k < runs[i].ends.size(); ++k, p += width) {
+      const uint64_t v = base + runs[i].ends[k];
+      if (width == 4) {
+        const int32_t v32 = (int32_t)v;
+        memcpy(p, &v32, 4);
+      } else {
+        const int64_t v64 = (int64_t)v;
+        memcpy(p, &v64, 8);
+      }
+    }
+  PyObject *const d = new_buffer(data, "B");
+  PyObject *const o = d ? new_buffer(offsets, width == 4 ? "i" : "q") : NULL;
+  PyObject *const result = o ? PyTuple_Pack(2, d, o) : NULL;
+  Py_XDECREF(d);
+  Py_XDECREF(o);
+  return result;
+}
+
+// The model argument, NULL for None, or set an exception and return false.
+static bool model_arg(PyObject *arg, const fpaq0f2_model **model) {
+  *model = NULL;
+  if (!arg || arg == Py_None) return true;
+  if (!PyObject_TypeCheck(arg, (PyTypeObject *)g_model_type)) {
+    PyErr_SetString(PyExc_TypeError, "model must be an fss.Model or None");
+    return false;
+  }
+  *model = ((Model *)arg)->model;
+  return true;
+}
+
+static PyObject *code(PyObject *args, PyObject *kw, bool decompress) {
+  static const char *kwlist[] = {"data", "offsets", "model", "threads", NULL};
+  PyObject *d, *o, *m = NULL;
+  int threads = 1;
+  if (!PyArg_ParseTupleAndKeywords(args, kw, decompress ? "OO|Oi:decompress" : "OO|Oi:compress",
+                                   (char **)kwlist, &d, &o, &m, &threads))
+    return NULL;
+  const fpaq0f2_model *model;
+  if (!model_arg(m, &model)) return NULL;
+  if (threads < 1 || threads > 1024) {
+    PyErr_SetString(PyExc_ValueError, "threads must be 1 to 1024");
+    return NULL;
+  }
+  Column c;
+  if (!c.get(d, o)) return NULL;
+
+  std::vector<Run> runs;
+  try {
+    const size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+    runs.resize(std::max<size_t>(1, std::min<size_t>(std::min<size_t>(threads, cpus), c.count)));
+  } catch (const std::bad_alloc &) {
+    return PyErr_NoMemory();
+  }
+  for (size_t i = 0; i < runs.size(); ++i) {
+    runs[i].first = c.count * i / runs.size();
+    runs[i].last = c.count * (i + 1) / runs.size();
+  }
+  Py_BEGIN_ALLOW_THREADS
+  std::vector<std::thread> workers;
+  try {
+    for (size_t i = 1; i < runs.size(); ++i) workers.emplace_back(code_run, std::cref(c), model, decompress, std::ref(runs[i]));
+  } catch (const std::exception &) {
+    for (size_t i = workers.size() + 1; i < runs.size(); ++i) code_run(c, model, decompress, runs[i]);
+  }
+  code_run(c, model, decompress, runs[0]);
+  for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+  Py_END_ALLOW_THREADS
+
+  for (size_t i = 0; i < runs.size(); ++i) {
+    if (runs[i].nomem) return PyErr_NoMemory();
+    if (runs[i].failed != SIZE_MAX)
+      return PyErr_Format(PyExc_ValueError, "value %zu %s", runs[i].failed,
+                          decompress ? "is not compressed with this model" : "cannot be compressed");
+  }
+  return join(runs, c.width);
+}
+
+//////////////////////////// module ////////////////////////////
+
+static PyObject *fss_compress(PyObject *, PyObject *args, PyObject *kw) {
+  return code(args, kw, false);
+}
+
+static PyObject *fss_decompress(PyObject *, PyObject *args, PyObject *kw) {
+  return code(args, kw, true);
+}
+
+static PyObject *fss_train(PyObject *, PyObject *args, PyObject *kw) {
+  static const char *kwlist[] = {"data", "offsets", NULL};
+  PyObject *d, *o;
+  if (!PyArg_ParseTupleAndKeywords(args, kw, "OO:train", (char **)kwlist, &d, &o)) return NULL;
+  Column c;
+  if (!c.get(d, o)) return NULL;
+  if (!c.count) {
+    PyErr_SetString(PyExc_ValueError, "no values to train on");
+    return NULL;
+  }
+  std::vector<size_t> lens;
+  try {
+    lens.resize(c.count);
+  } catch (const std::bad_alloc &) {
+    return PyErr_NoMemory();
+  }
+  for (size_t k = 0; k < c.count; ++k) lens[k] = c.size(k);
+  fpaq0f2_model *m;
+  Py_BEGIN_ALLOW_THREADS
+  m = fpaq0f2_model_train(c.value(0), lens.data(), c.count);
+  Py_END_ALLOW_THREADS
+  if (!m) return PyErr_NoMemory();
+  return new_model(m, true);
+}
+
+static PyObject *fss_default_model(PyObject *, PyObject *) {
+  return new_model((fpaq0f2_model *)fpaq0f2_model_default(), false);
+}
+
+static PyMethodDef fss_methods[] = {
+  {"compress", (PyCFunction)(void (*)(void))fss_compress, METH_VARARGS | METH_KEYWORDS,
+   "compress(data, offsets, model=None, threads=1) -> (data, offsets)\n\n"
+   "Compress each value of an Arrow style column, with a frozen model or adaptively,\n"
+   "in up to threads (1 to 1024) runs, no more than the hardware threads."},
+  {"decompress", (PyCFunction)(void (*)(void))fss_decompress, METH_VARARGS | METH_KEYWORDS,
+   "decompress(data, offsets, model=None, threads=1) -> (data, offsets)\n\n"
+   "Decompress each value of a column compressed by compress() with the same model."},
+  {"train", (PyCFunction)(void (*)(void))fss_train, METH_VARARGS | METH_KEYWORDS,
+   "train(data, offsets) -> Model\n\nTrain a frozen model on the values of a column."},
+  {"default_model", fss_default_model, METH_NOARGS, "default_model() -> Model, the untrained built-in model"},
+  {NULL, NULL, 0, NULL},
+};
+
+static struct PyModuleDef fss_module = {
+  PyModuleDef_HEAD_INIT, "fss", "Short string compression of whole columns by fpaq0f2.", -1, fss_methods,
+  NULL, NULL, NULL, NULL,
+};
+
+PyMODINIT_FUNC PyInit_fss(void) {
+  PyObject *const m = PyModule_Create(&fss_module);
+  if (!m) return NULL;
+  if (!g_buffer_type) g_buffer_type = PyType_FromSpec(&buffer_spec);
+  if (!g_model_type) g_model_type = PyType_FromSpec(&model_spec);
+  if (!g_buffer_type || !g_model_type || PyModule_AddObjectRef(m, "Buffer", g_buffer_type) ||
+      PyModule_AddObjectRef(m, "Model", g_model_type)) {
+    Py_DECREF(m);
+    return NULL;
+  }
+  return m;
+}
@@ -0,0 +1,23 @@
+# Builds the fss module: pip install .
+import os
+
+from setuptools import Extension, setup
+
+# The library sources, by absolute path so that their objects stay in the build directory.
+lib = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "ext", "fpaq0f2")
+
+setup(
+    name="fss",
+    version="0.1",
+    description="Short string compression of whole columns by fpaq0f2",
+    python_requires=">=3.10",
+    ext_modules=[
+        Extension(
+            "fss",
+            sources=["fss_python.cpp", os.path.join(lib, "fpaq0f2.cpp")],
+            include_dirs=[lib],
+            extra_compile_args=["-std=c++17"],
+            language="c++",
+        )
+    ],
+)
@@ -0,0 +1,251 @@
+/* fss_sqlite - SQLite extension storing short strings compressed by frozen models.
+
+To compile: g++ -O2 -std=c++17 -shared -fPIC -I../../ext/fpaq0f2 fss_sqlite.cpp ../../ext/fpaq0f2/fpaq0f2.cpp -o fss.so
+To load:    .load ./fss  in the sqlite3 shell, or  SELECT load_extension('./fss');
+
+  fss_compress(x [, model])
+    compresses the text or blob x with the model saved in the file model by
+    tools/fss_train, or with the built-in model if there is none or it is
+    NULL, into a blob framed as by fpaq0f2_frame_compress(), which names its
+    model. NULL stays NULL. With a model, the result depends on the contents
+    of the file as this connection first loaded it, not only on the
+    arguments, so an index or generated column on it is only valid while the
+    file does not change.
+  fss_decompress(x)
+    returns the text of a value compressed by fss_compress(). Its model must
+    be the built-in one, or one loaded in this connection by fss_compress()
+    or fss_load_model(), so whether it succeeds depends on the connection,
+    and SQLite does not treat it as deterministic.
+  fss_load_model(model)
+    loads the model file for fss_decompress(), and returns its id. It is not
+    deterministic either.
+  COLLATE fss
+    orders values compressed by fss_compress() as their texts, without
+    decompressing them: a frozen model keeps the reverse order of its inputs.
+    Values of different models are ordered by model id first. SQLite only
+    collates text, so the values must be stored as text:
+
+      CREATE TABLE t(k TEXT COLLATE fss PRIMARY KEY);
+      INSERT INTO t VALUES(CAST(fss_compress('...', 'urls.model') AS TEXT));
+      SELECT fss_decompress(k) FROM t ORDER BY k;
+
+A model file is loaded once per connection and path, and kept until the
+connection closes. A statement whose model argument is constant finds the
+model in its auxiliary data, so a row costs the coding and one allocation
+for the result.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include <new>
+#include <string>
+#include <vector>
+
+#include <sqlite3ext.h>
+SQLITE_EXTENSION_INIT1
+
+#include "fpaq0f2.h"
+
+//////////////////////////// models ////////////////////////////
+
+// The models of one connection, shared by its functions, freed with the last of them.
+struct Models {
+  std::vector<std::pair<std::string, fpaq0f2_model *>> loaded;  // by path
+  uint32_t default_id;
+  int refs;
+
+  Models(): default_id(fpaq0f2_model_id(fpaq0f2_model_default())), refs(0) {}
+  ~Models() {
+    for (size_t k = 0; k < loaded.size(); ++k) fpaq0f2_model_free(loaded[k].second);
+  }
+
+  // Return the model saved in the file at path, loading it the first time, or NULL.
+  const fpaq0f2_model *load(const char *path) {
+    for (size_t k = 0; k < loaded.size(); ++k)
+      if (loaded[k].first == path) return loaded[k].second;
+    fpaq0f2_model *m = fpaq0f2_model_load_file(path);
+    if (m) loaded.push_back(std::make_pair(std::string(path), m));
+    return m;
+  }
+
+  // Return the loaded model of this id, or NULL.
+  const fpaq0f2_model *find(uint32_t id) const {
+    if (id == default_id) return fpaq0f2_model_default();
+    for (size_t k = 0; k < loaded.size(); ++k)
+      if (fpaq0f2_model_id(loaded[k].second) == id) return loaded[k].second;
+    return NULL;
+  }
+};
+
+static void release(void *p) {
+  Models *const models = (Models *)p;
+  if (0 == --models->refs) delete models;
+}
+
+// The model named by argv[i], cached in the statement while the argument is constant.
+// Return NULL after setting an error.
+static const fpaq0f2_model *model_arg(sqlite3_context *ctx, sqlite3_value **argv, int i) {
+  if (const void *m = sqlite3_get_auxdata(ctx, i)) return (const fpaq0f2_model *)m;
+  const char *const path = (const char *)sqlite3_value_text(argv[i]);
+  if (!path) {
+    sqlite3_result_error(ctx, "fss: the model must be a file name", -1);
+    return NULL;
+  }
+  const fpaq0f2_model *m = ((Models *)sqlite3_user_data(ctx))->load(path);
+  if (!m) {
+    char *const msg = sqlite3_mprintf("fss: %s is not a model file", path);
+    sqlite3_result_error(ctx, msg, -1);
+    sqlite3_free(msg);
+    return NULL;
+  }
+  sqlite3_set_auxdata(ctx, i, (void *)m, NULL);  // owned by Models
+  return m;
+}
+
+// The bytes of a text or blob argument, text in UTF-8.
+static const void *bytes_arg(sqlite3_value *v, int *len) {
+  const void *p = sqlite3_value_type(v) == SQLITE_TEXT ? (const void *)sqlite3_value_text(v) : sqlite3_value_blob(v);
+  *len = sqlite3_value_bytes(v);
+  return p;
+}
+
+//////////////////////////// functions ////////////////////////////
+
+static void fss_compress(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  if (sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+  const fpaq0f2_model *model = fpaq0f2_model_default();
+  if (argc > 1 && sqlite3_value_type(argv[1]) != SQLITE_NULL && !(model = model_arg(ctx, argv, 1))) return;
+  int len;
+  const void *const in = bytes_arg(argv[0], &len);
+  if (!in && len) {
+    sqlite3_result_error_nomem(ctx);
+    return;
+  }
+  for (size_t room = len + len / 4 + 32; ; room *= 2) {
+    char *const out = (char *)sqlite3_malloc64(room);
+    if (!out) {
+      sqlite3_result_error_nomem(ctx);
+      return;
+    }
+    const size_t n = fpaq0f2_frame_compress(model, in, len, out, room, 0);
+    if (n <= room) {
+      sqlite3_result_blob64(ctx, out, n, sqlite3_free);
+      return;
+    }
+    sqlite3_free(out);
+    if (n == SIZE_MAX) {
+      sqlite3_result_error(ctx, "fss_compress: cannot compress", -1);
+      return;
+    }
+  }
+}
+
+static void fss_decompress(sqlite3_context *ctx, int, sqlite3_value **argv) {
+  if (sqlite3_value_type(argv[0]) == SQLITE_NULL) return;
+  int len;
+  const void *const in = bytes_arg(argv[0], &len);
+  fpaq0f2_frame_info info;
+  if (fpaq0f2_frame_parse(in, len, &info)) {
+    sqlite3_result_error(ctx, "fss_decompress: not a compressed value", -1);
+    return;
+  }
+  const fpaq0f2_model *model = NULL;
+  if ((info.flags & FPAQ0F2_FRAME_MODEL) && !(model = ((Models *)sqlite3_user_data(ctx))->find(info.model_id))) {
+    char *const msg = sqlite3_mprintf("fss_decompress: model %08x is not loaded", info.model_id);
+    sqlite3_result_error(ctx, msg, -1);
+    sqlite3_free(msg);
+    return;
+  }
+  if (info.length > (size_t)sqlite3_limit(sqlite3_context_db_handle(ctx), SQLITE_LIMIT_LENGTH, -1)) {
+    sqlite3_result_error_toobig(ctx);
+    return;
+  }
+  char *const out = (char *)sqlite3_malloc64(info.length + 1);
+  if (!out) {
+    sqlite3_result_error_nomem(ctx);
+    return;
+  }
+  if (fpaq0f2_frame_decompress(model, in, len, out, info.length) != info.length) {
+    sqlite3_free(out);
+    sqlite3_result_error(ctx, "fss_decompress: corrupt value", -1);
+    return;
+  }
+  out[info.length] = 0;
+  sqlite3_result_text64(ctx, out, info.length, sqlite3_free, SQLITE_UTF8);
+}
+
+static void fss_load_model(sqlite3_context *ctx, int, sqlite3_value **argv) {
+  if (const fpaq0f2_model *m = model_arg(ctx, argv, 0)) sqlite3_result_int64(ctx, fpaq0f2_model_id(m));
+}
+
+//////////////////////////// collation ////////////////////////////
+
+static int compare_bytes(const void *a, size_t n, const void *b, size_t m) {
+  const int c = memcmp(a, b, n < m ? n : m);
+  return c ? c : n < m ? -1 : n > m;
+}
+
+// The text of a compressed value, or its bytes if its model is not at hand.
+static std::string text_of(const Models *models, const void *p, int n, const fpaq0f2_frame_info &info) {
+  std::string s(info.length, '\0');
+  const fpaq0f2_model *const model = info.flags & FPAQ0F2_FRAME_MODEL ? models->find(info.model_id) : NULL;
+  if ((model || !(info.flags & FPAQ0F2_FRAME_MODEL)) &&
+      fpaq0f2_frame_decompress(model, p, n, &s[0], s.size()) == s.size())
+    return s;
+  return std::string((const char *)p, n);
+}
+
+// Values that are not compressed first, in byte order, then by model id, then, within
+// one frozen model, in the reverse byte order of the compressed bytes, which is the byte
+// order of the texts. Adaptive values have no such order and are decompressed.
+static int fss_collate(void *models, int n, const void *a, int m, const void *b) {
+  fpaq0f2_frame_info x, y;
+  const bool fx = 0 == fpaq0f2_frame_parse(a, n, &x), fy = 0 == fpaq0f2_frame_parse(b, m, &y);
+  if (!fx || !fy) return fx != fy ? (fx ? 1 : -1) : compare_bytes(a, n, b, m);
+  if (x.model_id != y.model_id) return x.model_id < y.model_id ? -1 : 1;
+  if (!(x.flags & FPAQ0F2_FRAME_MODEL)) {
+    const std::string s = text_of((Models *)models, a, n, x), t = text_of((Models *)models, b, m, y);
+    return compare_bytes(s.data(), s.size(), t.data(), t.size());
+  }
+  return -compare_bytes((const char *)a + x.header_size, n - x.header_size, (const char *)b + y.header_size,
+                        m - y.header_size);
+}
+
+//////////////////////////// init ////////////////////////////
+
+#ifdef _WIN32
+__declspec(dllexport)
+#endif
+extern "C" int sqlite3_fss_init(sqlite3 *db, char **, const sqlite3_api_routines *api) {
+  SQLITE_EXTENSION_INIT2(api);
+  Models *const models = new (std::nothrow) Models;
+  if (!models) return SQLITE_NOMEM;
+  // fss_decompress() depends on the models loaded and fss_load_model() loads one, so
+  // neither may be factored out of a query or used in an index.
+  static const struct {
+    const char *name;
+    int args;
+    int flags;
+    void (*func)(sqlite3_context *, int, sqlite3_value **);
+  } funcs[] = {
+    {"fss_compress", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, fss_compress},
+    {"fss_compress", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC, fss_compress},
+    {"fss_decompress", 1, SQLITE_UTF8, fss_decompress},
+    {"fss_load_model", 1, SQLITE_UTF8, fss_load_model},
+  };
+  ++models->refs;  // until registered
+  int rc = SQLITE_OK;
+  for (size_t k = 0; rc == SQLITE_OK && k < sizeof(funcs) / sizeof(funcs[0]); ++k) {
+    ++models->refs;
+    rc = sqlite3_create_function_v2(db, funcs[k].name, funcs[k].args, funcs[k].flags, models, funcs[k].func,
+                                    NULL, NULL, release);
+  }
+  if (rc == SQLITE_OK) {
+    ++models->refs;
+    rc = sqlite3_create_collation_v2(db, "fss", SQLITE_UTF8, models, fss_collate, release);
+    if (rc != SQLITE_OK) release(models);  // not called on failure
+  }
+  release(models);
+  return rc;
+}
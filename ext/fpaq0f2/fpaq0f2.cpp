@@ -10,9 +10,39 @@ modeled in the context of the previous bits in the current byte, plus
 the bit history (last 8 bits) observed in this context.
 */
 
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#ifdef FPAQ0F2_METRICS
+#include <stdarg.h>
+
+#include <chrono>
+#include <string>
+#endif
+
+#if defined(__SSE4_2__) || defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#if !defined(FPAQ0F2_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define FPAQ0F2_USDT
+#endif
+#endif
+
 #include "fpaq0f2.h"
 
 
@@ -21,10 +51,46 @@ typedef unsigned char  U8;
 typedef unsigned short U16;
 typedef unsigned int   U32;
 
-// Create an array p of n elements of type T
-template <class T> void alloc(T*&p, int n) {
+// Create an array p of n elements of type T, return false if out of memory
+template <class T> bool alloc(T*&p, int n) {
   p=(T*)calloc(n, sizeof(T));
-  if (!p) fprintf(stderr, "out of memory\n"), exit(1);
+  return p!=NULL;
+}
+
+//////////////////////////// Stats //////////////////////////
+
+/* Built with -DFPAQ0F2_STATS, STAT(field, n) adds n to a counter of the
+   calling thread's fpaq0f2_stats. Otherwise it compiles to nothing, and
+   the coder is the same as without it.
+*/
+
+#ifdef FPAQ0F2_STATS
+static thread_local fpaq0f2_stats stats;
+#define STAT(field, n) (stats.field += (n))
+#else
+#define STAT(field, n) ((void)0)
+#endif
+
+extern "C"
+int
+fpaq0f2_stats_get(fpaq0f2_stats * const s)
+{
+#ifdef FPAQ0F2_STATS
+    *s = stats;
+    return 0;
+#else
+    memset(s, 0, sizeof(*s));
+    return -1;
+#endif
+}
+
+extern "C"
+void
+fpaq0f2_stats_reset(void)
+{
+#ifdef FPAQ0F2_STATS
+    memset(&stats, 0, sizeof(stats));
+#endif
 }
 
 //////////////////////////// StateMap //////////////////////////
@@ -33,14 +99,30 @@ template <class T> void alloc(T*&p, int n) {
 // map is updated in the direction of the actual value to improve future
 // predictions in the same context.
 
+// Constant tables, built at compile time so that threads share them
+// without any initialization at run time.
+struct StateMapTables {
+  U32 init[256];  // bit history -> initial entry; it only depends on the low 8 bits
+  int dt[256];    // reciprocal table: i -> 16K/(i+1.5)
+  constexpr StateMapTables(): init(), dt() {
+    for (U32 i=0; i<256; ++i) {
+      // Count 1 bits to determine initial probability.
+      U32 n=(i&1)*2+(i&2)+(i>>2&1)+(i>>3&1)+(i>>4&1)+(i>>5&1)+(i>>6&1)+(i>>7&1)+3;
+      init[i]=n<<28|6;
+      dt[i]=32768/(i+i+3);
+    }
+  }
+};
+static constexpr StateMapTables statemap_tables;
+
 class StateMap {
 protected:
   const int N;  // Number of contexts
   int cxt;      // Context of last prediction
   U32 *t;       // cxt -> prediction in high 24 bits, count in low 8 bits
-  static int dt[256];  // reciprocal table: i -> 16K/(i+1.5)
 public:
   StateMap(int n=256);  // create allowing n contexts
+  bool ok() const { return t!=NULL; }  // false if out of memory
 
   // Predict next bit to be updated in context cx (0..n-1).
   // Return prediction as a 16 bit number (0..65535) that next bit is 1.
@@ -55,11 +137,22 @@ public:
     assert(cxt>=0 && cxt<N);
     assert(y==0 || y==1);
     assert(limit>=0 && limit<255);
+    STAT(model_updates, 1);
     int n=t[cxt]&255, p=t[cxt]>>14;  // count, prediction
     if (n<limit) ++t[cxt];
-    t[cxt]+=((y<<18)-p)*dt[n]&0xffffff00;
+    t[cxt]+=((y<<18)-p)*statemap_tables.dt[n]&0xffffff00;
+  }
+
+  // Store the high 16 bits of every prediction into f[0..N-1].
+  void freeze(U16 *f) const {
+    for (int i=0; i<N; ++i)
+      f[i]=t[i]>>16;
   }
 
+  // Forget what was learned in contexts [first, first+n), or in all of them.
+  void reset(int first, int n);
+  void reset() { reset(0, N); }
+
   ~StateMap() {
     if (t) {
       free(t);
@@ -68,19 +161,20 @@ public:
   }
 };
 
-int StateMap::dt[256]={0};
-
 // Initialize assuming low 8 bits of context is a bit history.
 StateMap::StateMap(int n): N(n), cxt(0) {
-  alloc(t, N);
-  for (int i=0; i<N; ++i) {
-    // Count 1 bits to determine initial probability.
-    U32 n=(i&1)*2+(i&2)+(i>>2&1)+(i>>3&1)+(i>>4&1)+(i>>5&1)+(i>>6&1)+(i>>7&1)+3;
-    t[i]=n<<28|6;
-  }
-  if (dt[0]==0)
-    for (int i=0; i<256; ++i)
-      dt[i]=32768/(i+i+3);
+  STAT(model_allocs, 1);
+  if (alloc(t, N)) reset();
+}
+
+void StateMap::reset(const int first, const int n) {
+  assert(first>=0 && n>=0 && first+n<=N);
+  STAT(entries_reset, n);
+  for (int i=first; i<first+n; ) {
+    const int k = 256-(i&255) < first+n-i ? 256-(i&255) : first+n-i;
+    memcpy(t+i, statemap_tables.init+(i&255), k*sizeof(U32));
+    i+=k;
+  }
 }
 
 //////////////////////////// Predictor /////////////////////////
@@ -92,13 +186,16 @@ StateMap::StateMap(int n): N(n), cxt(0) {
 */
 
 class Predictor {
-  int cxt;  // Context: 0=not EOF, 1..255=last 0-7 bits with a leading 1
+  int cxt;  // Context: 0=not EOF, 1..top-1=last bits of the symbol with a leading 1
+  const int top;  // 1<<bits, the end of a symbol
+  const int wrap; // Context of the next symbol: 0, or 1 if fixed width with no flag
   StateMap sm;
   int state[256];
 public:
-  Predictor();
+  Predictor(int bits=8, bool fixed=false);
+  bool ok() const { return sm.ok(); }
 
-  // Assume order 0 stream of 9-bit symbols
+  // Assume order 0 stream of 1+bits bit symbols
   int p() {
     return sm.p(cxt<<8|state[cxt]);
   }
@@ -107,16 +204,99 @@ public:
     sm.update(y, 90);
     int& st=state[cxt];
     (st+=st+y)&=255;
-    if ((cxt+=cxt+y) >= 256)
-      cxt=0;
+    if ((cxt+=cxt+y) >= top)
+      cxt=wrap;
   }
+
+  // Forget the bit histories, as at the start of a new string,
+  // but keep what the StateMap has learned so far.
+  void restart() {
+    cxt=wrap;
+    for (int i=0; i<0x100; ++i)
+      state[i]=0x66;
+  }
+
+  // Forget what was learned in context c only, the 256 bit histories of
+  // the StateMap under it.
+  void reset(int c) {
+    assert(c>=0 && c<top);
+    sm.reset(c<<8, 256);
+  }
+
+  // The context of the next bit.
+  int context() const { return cxt; }
+
+  void freeze(U16 *t) const { sm.freeze(t); }
+};
+
+// Codes with a Predictor owned by someone else, which outlives the Encoder,
+// and marks touched[c] for every context c it updates, so the owner can
+// reset just those.
+class PredictorRef {
+  Predictor& pr;
+  U8 *const touched;
+public:
+  PredictorRef(Predictor* p, U8* t): pr(*p), touched(t) {}
+  bool ok() const { return true; }
+  int p() { return pr.p(); }
+  void update(int y) {
+    touched[pr.context()]=1;
+    pr.update(y);
+  }
+  void restart() { pr.restart(); }
 };
 
-Predictor::Predictor(): cxt(0), sm(0x10000) {
-  for (int i=0; i<0x100; ++i)
-    state[i]=0x66;
+// A bits deep symbol tree has 1<<bits contexts, each of 256 bit histories.
+Predictor::Predictor(const int bits, const bool fixed): cxt(0), top(1<<bits), wrap(fixed), sm(top<<8) {
+  restart();
 }
 
+//////////////////////////// FrozenPredictor ///////////////////
+
+/* A frozen model is a snapshot of the Predictor's StateMap predictions.
+   It is never written while coding, so one model can be shared by any
+   number of threads, and the same input always compresses to the same
+   bytes.
+*/
+
+struct fpaq0f2_model {
+  U16 t[0x10000];  // cxt<<8|bit history -> P(1) (0..65535)
+  U32 id;          // CRC32C of t as saved, names the model in frames
+};
+
+/* A FrozenPredictor has the same contexts as a Predictor, but reads its
+   predictions from a frozen model.  Only the bit histories adapt, so
+   setting one up costs 256 bytes instead of a 256 KB StateMap.
+*/
+
+class FrozenPredictor {
+  int cxt;  // Context: 0=not EOF, 1..255=last 0-7 bits with a leading 1
+  const int wrap;  // Context of the next byte: 0, or 1 if fixed width with no flag
+  const U16 *const t;
+  U8 state[256];
+public:
+  FrozenPredictor(const fpaq0f2_model *m, bool fixed=false): wrap(fixed), t(m->t) {
+    restart();
+  }
+  bool ok() const { return true; }
+
+  void restart() {
+    cxt=wrap;
+    memset(state, 0x66, sizeof(state));
+  }
+
+  int p() {
+    return t[cxt<<8|state[cxt]];
+  }
+
+  void update(int y) {
+    U8& st=state[cxt];
+    st+=st+y;
+    if ((cxt+=cxt+y) >= 256)
+      cxt=wrap;
+  }
+};
+
 
 //////////////////////////// Encoder ////////////////////////////
 
@@ -128,56 +308,103 @@ Predictor::Predictor(): cxt(0), sm(0x10000) {
    encode(bit) in COMPRESS mode compresses bit to file f.
    decode() in DECOMPRESS mode returns the next decompressed bit from file f.
    flush() should be called when there is no more to compress.
+   ok() is false if the predictor could not allocate its model, and then
+     the Encoder must not code.
 */
 
 typedef enum {COMPRESS, DECOMPRESS} Mode;
+template <class P>
 class Encoder {
 private:
-  Predictor predictor;   // Computes next bit probability (0..65535)
+  P predictor;           // Computes next bit probability (0..65535)
   const Mode mode;       // Compress or decompress?
   //FILE* archive;         // Compressed data file
-  const U8 *const inBuf; // read compressed data
-  U8 *const outBuf;      // write compressed data
+  const U8 *inBuf;       // read compressed data
+  U8 *outBuf;            // write compressed data
   U32 bufIdx;            // archive data index
-  const U32 bufSize;     // archive data size
+  U32 bufSize;           // archive data size
+  U32 bufBase;           // archive data in the previous segments
+  U32 pads;              // zeros read past the end of the archive
+  const fpaq0f2_iovec *seg, *segEnd;  // archive segments after this one
   U32 x1, x2;            // Range, initially [0, 1), scaled by 2^32
   U32 x;                 // Last 4 input bytes of archive.
+  void start();
+  bool nextBuf();        // Move to the next non-empty segment
 public:
-  Encoder(Mode m, U8* buf, U32 size);
-  Encoder(Mode m, const U8* buf, U32 size);
+  template <class... A>  // Construct the predictor with args
+  Encoder(Mode m, const fpaq0f2_iovec* segs, size_t n, A... args);
   bool encode(int y);    // Compress bit y, return false if buffer overflow
   int decode();          // Uncompress and return bit y
   bool flush();          // Call when done compressing
-  U32 getBufIdx() { return bufIdx; }
+  U32 getBufIdx() { return bufBase+bufIdx; }
+  bool ok() const { return predictor.ok(); }
+
+  // A whole archive is read with at most 3 zeros past its end, since
+  // flush() writes at least 1 byte the decoder never shifts in.
+  bool overrun() const { return pads > 3; }
+
+  // Continue coding in another buffer, from its start.
+  void setBuf(U8* buf, U32 size) { outBuf=buf, bufIdx=0, bufSize=size, bufBase=0, seg=segEnd; }
+  void setBuf(const U8* buf, U32 size) { inBuf=buf, bufIdx=0, bufSize=size, bufBase=0, seg=segEnd; }
+
+  // Start coding a new value where the last one was flushed, or in
+  // DECOMPRESS mode, from the buffer set last, without a new Encoder.
+  void restart();
 };
 
-// Constructor COMPRESS MODE
-Encoder::Encoder(const Mode m, U8* const buf, const U32 size): predictor(), mode(m),
-                                   inBuf(NULL), outBuf(buf), bufIdx(0), bufSize(size), x1(0),
-                                   x2(0xffffffff), x(0) {
-  assert(COMPRESS == m);
+// The archive is the concatenation of n segments, written in COMPRESS
+// mode and read in DECOMPRESS mode.
+template <class P>
+template <class... A>
+Encoder<P>::Encoder(const Mode m, const fpaq0f2_iovec* const segs, const size_t n,
+                    A... args): predictor(args...), mode(m),
+                                   inBuf(NULL), outBuf(NULL), bufIdx(0), bufSize(0), bufBase(0), pads(0),
+                                   seg(segs), segEnd(segs+n), x1(0), x2(0xffffffff), x(0) {
+  nextBuf();
+  start();
 }
-Encoder::Encoder(const Mode m, const U8* const buf, const U32 size): predictor(), mode(m),
-                                   inBuf(buf), outBuf(NULL), bufIdx(0), bufSize(size), x1(0),
-                                   x2(0xffffffff), x(0) {
 
-  assert(DECOMPRESS == m);
+template <class P>
+void Encoder<P>::restart() {
+  predictor.restart();
+  x1=0, x2=0xffffffff, x=0, pads=0;
+  start();
+}
 
+template <class P>
+void Encoder<P>::start() {
+  STAT(values, 1);
   // In DECOMPRESS mode, initialize x to the first 4 bytes of the archive
   if (mode==DECOMPRESS) {
     for (int i=0; i<4; ++i) {
       int c=0;
-      if (bufIdx <= bufSize) c = inBuf[bufIdx++];
+      if (bufIdx < bufSize || nextBuf()) c = inBuf[bufIdx++], STAT(bytes_in, 1);
+      else ++pads, STAT(pads, 1);
       x=(x<<8)+(c&0xff);
     }
   }
 }
 
+template <class P>
+bool Encoder<P>::nextBuf() {
+  while (seg < segEnd) {
+    const fpaq0f2_iovec& v = *seg++;
+    if (0 == v.len) continue;
+    bufBase+=bufIdx;
+    inBuf=outBuf=(U8*)v.base;
+    bufIdx=0;
+    bufSize=v.len;
+    return true;
+  }
+  return false;
+}
+
 // encode(y) -- Encode bit y by splitting the range [x1, x2] in proportion
 // to P(1) and P(0) as given by the predictor and narrowing to the appropriate
 // subrange.  Output leading bytes of the range as they become known.
 
-inline bool Encoder::encode(int y) {
+template <class P>
+inline bool Encoder<P>::encode(int y) {
 
   // Update the range
   const U32 p=predictor.p();
@@ -190,11 +417,12 @@ inline bool Encoder::encode(int y) {
   else
     x1=xmid+1;
   predictor.update(y);
+  STAT(bits_encoded, 1);
 
   // Shift equal MSB's out
   while (((x1^x2)&0xff000000)==0) {
-    if (bufIdx < bufSize) outBuf[bufIdx++] = x2>>24;
-    else return false;
+    if (bufIdx < bufSize || nextBuf()) outBuf[bufIdx++] = x2>>24, STAT(bytes_out, 1);
+    else return STAT(overflows, 1), false;
     //putc(x2>>24, archive);
     x1<<=8;
     x2=(x2<<8)+255;
@@ -206,7 +434,8 @@ inline bool Encoder::encode(int y) {
 // Decode one bit from the archive, splitting [x1, x2] as in the encoder
 // and returning 1 or 0 depending on which subrange the archive point x is in.
 
-inline int Encoder::decode() {
+template <class P>
+inline int Encoder<P>::decode() {
 
   // Update the range
   const U32 p=predictor.p();
@@ -221,13 +450,15 @@ inline int Encoder::decode() {
   else
     x1=xmid+1;
   predictor.update(y);
+  STAT(bits_decoded, 1);
 
   // Shift equal MSB's out
   while (((x1^x2)&0xff000000)==0) {
     x1<<=8;
     x2=(x2<<8)+255;
     int c=0;
-    if (bufIdx < bufSize) c = inBuf[bufIdx++];
+    if (bufIdx < bufSize || nextBuf()) c = inBuf[bufIdx++], STAT(bytes_in, 1);
+    else ++pads, STAT(pads, 1);
     //int c=getc(archive);
     //if (c==EOF) c=0;
     x=(x<<8)+c;
@@ -236,61 +467,2408 @@ inline int Encoder::decode() {
 }
 
 // Should be called when there is no more to compress.
-bool Encoder::flush() {
+template <class P>
+bool Encoder<P>::flush() {
 
   // In COMPRESS mode, write out the remaining bytes of x, x1 < x < x2
   if (mode==COMPRESS) {
     while (((x1^x2)&0xff000000)==0) {
-      if (bufIdx < bufSize) outBuf[bufIdx++] = x2>>24;
-      else return false;
+      if (bufIdx < bufSize || nextBuf()) outBuf[bufIdx++] = x2>>24, STAT(bytes_out, 1);
+      else return STAT(overflows, 1), false;
       //putc(x2>>24, archive);
       x1<<=8;
       x2=(x2<<8)+255;
     }
-    if (bufIdx < bufSize) outBuf[bufIdx++] = x2>>24; // First unequal byte
-    else return false;
+    if (bufIdx < bufSize || nextBuf()) outBuf[bufIdx++] = x2>>24, STAT(bytes_out, 1); // First unequal byte
+    else return STAT(overflows, 1), false;
     //putc(x2>>24, archive);  // First unequal byte
   }
   return true;
 }
 
-//////////////////////////// main ////////////////////////////
+//////////////////////////// Hash ////////////////////////////
+
+/* A Hash digests the uncompressed bytes while they are coded, so the fused
+   entry points check a value without reading it twice.  Methods:
+   update(c) adds byte c.
+   update(p, n) adds n bytes from p.
+   value() returns the 32 bit digest so far.
+   Build with -DFPAQ0F2_HASH=<class> to pick another one with these methods.
+*/
+
+class NoHash {
+public:
+  void update(int) {}
+  void update(const U8*, size_t) {}
+  U32 value() const { return 0; }
+};
+
+// CRC32C (Castagnoli), reflected polynomial 0x82f63b78, slicing by 8.
+struct Crc32cTable {
+  U32 t[8][256];
+  constexpr Crc32cTable(): t() {
+    for (U32 i=0; i<256; ++i) {
+      U32 c=i;
+      for (int k=0; k<8; ++k)
+        c = c&1 ? (c>>1)^0x82f63b78 : c>>1;
+      t[0][i]=c;
+    }
+    for (int k=1; k<8; ++k)
+      for (int i=0; i<256; ++i)
+        t[k][i] = t[k-1][i]>>8 ^ t[0][t[k-1][i]&255];
+  }
+};
+static constexpr Crc32cTable crc32c_table;
+
+#if !defined(__SSE4_2__) && !defined(__ARM_FEATURE_CRC32)
+static U32
+crc32c_soft(U32 c, const U8 *p, size_t n)
+{
+    const U32 (*const t)[256] = crc32c_table.t;
+    for (; n >= 8; n -= 8, p += 8) {
+      const U32 lo = c ^ (p[0] | p[1]<<8 | p[2]<<16 | (U32)p[3]<<24);
+      c = t[7][lo&255] ^ t[6][lo>>8&255] ^ t[5][lo>>16&255] ^ t[4][lo>>24] ^
+          t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+    }
+    while (n--)
+      c = t[0][(c^*p++)&255] ^ c>>8;
+    return c;
+}
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(__SSE4_2__)
+__attribute__((target("sse4.2")))
+#endif
+#if defined(__SSE4_2__) || ((defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__))
+static U32
+crc32c_sse42(U32 c, const U8 *p, size_t n)
+{
+#if defined(__x86_64__)
+    for (; n >= 8; n -= 8, p += 8) {
+      unsigned long long v;
+      memcpy(&v, p, 8);
+      c = (U32)_mm_crc32_u64(c, v);
+    }
+#endif
+    while (n--)
+      c = _mm_crc32_u8(c, *p++);
+    return c;
+}
+#define FPAQ0F2_HAVE_SSE42
+#endif
+
+// Raw CRC32C update, without the pre and post inversion.
+static U32
+crc32c_update(const U32 c, const U8 * const p, const size_t n)
+{
+#if defined(__SSE4_2__)
+    return crc32c_sse42(c, p, n);
+#elif defined(FPAQ0F2_HAVE_SSE42)
+    static const bool hw = __builtin_cpu_supports("sse4.2");
+    return hw ? crc32c_sse42(c, p, n) : crc32c_soft(c, p, n);
+#elif defined(__ARM_FEATURE_CRC32)
+    U32 r = c;
+    size_t i = 0;
+    for (; i+8 <= n; i += 8) {
+      unsigned long long v;
+      memcpy(&v, p+i, 8);
+      r = __crc32cd(r, v);
+    }
+    for (; i < n; ++i)
+      r = __crc32cb(r, p[i]);
+    return r;
+#else
+    return crc32c_soft(c, p, n);
+#endif
+}
+
+class Crc32c {
+  U32 c;
+public:
+  Crc32c(): c(0xffffffff) {}
+  void update(int b) {
+#if defined(__SSE4_2__)
+    c=_mm_crc32_u8(c, b);
+#elif defined(__ARM_FEATURE_CRC32)
+    c=__crc32cb(c, b);
+#else
+    c=crc32c_table.t[0][(c^b)&255]^c>>8;
+#endif
+  }
+  void update(const U8 *p, size_t n) { c=crc32c_update(c, p, n); }
+  U32 value() const { return ~c; }
+};
+
+// 32 bit FNV-1a.
+class Fnv1a {
+  U32 h;
+public:
+  Fnv1a(): h(2166136261u) {}
+  void update(int b) { h=(h^(b&255))*16777619u; }
+  void update(const U8 *p, size_t n) { while (n--) update(*p++); }
+  U32 value() const { return h; }
+};
+
+#ifndef FPAQ0F2_HASH
+#define FPAQ0F2_HASH Crc32c
+#endif
+typedef FPAQ0F2_HASH Hash;
+
+//////////////////////////// metrics ////////////////////////////
+
+/* Built with -DFPAQ0F2_METRICS, every entry point counts its call in the
+   metrics of its thread's shard. A thread takes the next shard the first
+   time it calls, so until there are more threads than shards no cache line
+   is written by two threads, and a call costs two clock reads and a few
+   relaxed increments. Rendering sums the shards, each counter as it is at
+   some point during the render.
+*/
+
+#ifdef FPAQ0F2_METRICS
+static const int METRIC_CODECS = FPAQ0F2_CODEC_FRAME + 1;
+static const int METRIC_SHARDS = 64;
+static const int LATENCY_BUCKETS = 18;  // up to 250 ns << k for k < 17, then the rest
+
+static const char * const codec_names[METRIC_CODECS] = {
+  "adaptive", "context", "model", "alphabet", "alphabet_block",
+  "token", "fixed", "model_fixed", "batch", "frame",
+};
+static const char * const mode_names[2] = {"compress", "decompress"};
+
+// The counters of one operation and codec
+struct Metric {
+  std::atomic<uint64_t> calls, errors, overflows, bytes_in, bytes_out, nanos;
+  std::atomic<uint64_t> latency[LATENCY_BUCKETS];
+};
+
+struct alignas(64) MetricShard {
+  Metric m[2][METRIC_CODECS];
+};
+
+static MetricShard metric_shards[METRIC_SHARDS];
+static std::atomic<unsigned> metric_threads(0);
+
+static inline void add(std::atomic<uint64_t>& a, uint64_t n) {
+  a.fetch_add(n, std::memory_order_relaxed);
+}
+
+// Count a call that read len bytes, returned result and took nanos ns.
+static void count(Mode mode, int codec, size_t len, size_t bufsize, size_t result, uint64_t nanos) {
+  static thread_local int shard = -1;
+  if (shard < 0) shard = (int)(metric_threads.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARDS);
+  Metric& m = metric_shards[shard].m[mode][codec];
+  add(m.calls, 1);
+  if (result == SIZE_MAX) add(m.errors, 1);
+  else if (result > bufsize) add(m.overflows, 1);
+  else add(m.bytes_in, len), add(m.bytes_out, result);
+  add(m.nanos, nanos);
+  int k = 0;
+  while (k < LATENCY_BUCKETS - 1 && nanos > (uint64_t)250 << k) ++k;
+  add(m.latency[k], 1);
+}
+
+// The counters of one operation and codec, summed over the shards
+struct MetricSum {
+  uint64_t calls, errors, overflows, bytes_in, bytes_out, nanos;
+  uint64_t latency[LATENCY_BUCKETS];
+};
+
+static void append(std::string& s, const char* fmt, ...) {
+  char buf[256];
+  va_list ap;
+  va_start(ap, fmt);
+  const int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (n > 0) s.append(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+// The metrics in the Prometheus text exposition format, with a series for
+// each operation and codec called so far.
+static std::string render_metrics() {
+  static MetricSum sum[2][METRIC_CODECS];
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
+  memset(sum, 0, sizeof(sum));
+  for (int i=0; i<METRIC_SHARDS; ++i) {
+    for (int mode=0; mode<2; ++mode) {
+      for (int c=0; c<METRIC_CODECS; ++c) {
+        const Metric& m = metric_shards[i].m[mode][c];
+        MetricSum& t = sum[mode][c];
+        t.calls += m.calls.load(std::memory_order_relaxed);
+        t.errors += m.errors.load(std::memory_order_relaxed);
+        t.overflows += m.overflows.load(std::memory_order_relaxed);
+        t.bytes_in += m.bytes_in.load(std::memory_order_relaxed);
+        t.bytes_out += m.bytes_out.load(std::memory_order_relaxed);
+        t.nanos += m.nanos.load(std::memory_order_relaxed);
+        for (int k=0; k<LATENCY_BUCKETS; ++k)
+          t.latency[k] += m.latency[k].load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  static const struct {
+    const char *name, *help;
+    uint64_t MetricSum::*field;
+  } counters[] = {
+    {"fpaq0f2_calls_total", "Calls of each operation and codec.", &MetricSum::calls},
+    {"fpaq0f2_errors_total", "Calls that returned SIZE_MAX.", &MetricSum::errors},
+    {"fpaq0f2_overflows_total", "Calls that returned bufsize + 1, the output buffer being too small.",
+     &MetricSum::overflows},
+    {"fpaq0f2_bytes_in_total", "Bytes read by calls that succeeded.", &MetricSum::bytes_in},
+    {"fpaq0f2_bytes_out_total", "Bytes written by calls that succeeded.", &MetricSum::bytes_out},
+  };
+  std::string s;
+  for (size_t i=0; i<sizeof(counters)/sizeof(counters[0]); ++i) {
+    append(s, "# HELP %s %s\n# TYPE %s counter\n", counters[i].name, counters[i].help, counters[i].name);
+    for (int mode=0; mode<2; ++mode)
+      for (int c=0; c<METRIC_CODECS; ++c)
+        if (sum[mode][c].calls)
+          append(s, "%s{op=\"%s\",codec=\"%s\"} %llu\n", counters[i].name, mode_names[mode], codec_names[c],
+                 (unsigned long long)(sum[mode][c].*counters[i].field));
+  }
+
+  s += "# HELP fpaq0f2_compression_ratio Bytes in over bytes out of the compress calls that succeeded.\n"
+       "# TYPE fpaq0f2_compression_ratio gauge\n";
+  for (int c=0; c<METRIC_CODECS; ++c)
+    if (sum[COMPRESS][c].bytes_out)
+      append(s, "fpaq0f2_compression_ratio{codec=\"%s\"} %.6f\n", codec_names[c],
+             (double)sum[COMPRESS][c].bytes_in / sum[COMPRESS][c].bytes_out);
+
+  s += "# HELP fpaq0f2_latency_seconds Time taken by each call.\n"
+       "# TYPE fpaq0f2_latency_seconds histogram\n";
+  for (int mode=0; mode<2; ++mode) {
+    for (int c=0; c<METRIC_CODECS; ++c) {
+      const MetricSum& t = sum[mode][c];
+      if (!t.calls) continue;
+      uint64_t n = 0;
+      for (int k=0; k<LATENCY_BUCKETS; ++k) {
+        n += t.latency[k];
+        char le[32];
+        if (k < LATENCY_BUCKETS - 1) snprintf(le, sizeof(le), "%g", 250e-9 * (1 << k));
+        else strcpy(le, "+Inf");
+        append(s, "fpaq0f2_latency_seconds_bucket{op=\"%s\",codec=\"%s\",le=\"%s\"} %llu\n",
+               mode_names[mode], codec_names[c], le, (unsigned long long)n);
+      }
+      append(s, "fpaq0f2_latency_seconds_sum{op=\"%s\",codec=\"%s\"} %.9f\n", mode_names[mode], codec_names[c],
+             t.nanos / 1e9);
+      append(s, "fpaq0f2_latency_seconds_count{op=\"%s\",codec=\"%s\"} %llu\n", mode_names[mode],
+             codec_names[c], (unsigned long long)n);
+    }
+  }
+  return s;
+}
+
+static int write_metrics(const char* path) {
+  const std::string s = render_metrics();
+  const std::string tmp = std::string(path) + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (!f) return -1;
+  const bool written = fwrite(s.data(), 1, s.size(), f) == s.size();
+  if (0 != fclose(f) || !written || 0 != rename(tmp.c_str(), path)) {
+    remove(tmp.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+// The thread of fpaq0f2_metrics_start(), which writes the metrics when it
+// starts, every interval and when it stops.
+class MetricWriter {
+  std::mutex control;  // serializes start() and stop()
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::thread thread;
+  bool stopping;
+
+  void run(const std::string path, const unsigned interval) {
+    std::unique_lock<std::mutex> lock(mutex);
+    do write_metrics(path.c_str());
+    while (!wake.wait_for(lock, std::chrono::seconds(interval), [this] { return stopping; }));
+    write_metrics(path.c_str());
+  }
+
+  void halt() {
+    if (!thread.joinable()) return;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    thread.join();
+  }
+
+public:
+  MetricWriter(): stopping(false) {}
+  ~MetricWriter() { stop(); }
+
+  void start(const char* path, unsigned interval) {
+    std::lock_guard<std::mutex> lock(control);
+    halt();
+    stopping = false;
+    thread = std::thread(&MetricWriter::run, this, std::string(path), interval);
+  }
+
+  void stop() {
+    std::lock_guard<std::mutex> lock(control);
+    halt();
+  }
+};
+
+static MetricWriter metric_writer;
+#endif
 
 extern "C"
 size_t
-fpaq0f2_compress(const void * const in, const size_t len, void * const out, const size_t bufsize)
+fpaq0f2_metrics_render(void * const out, const size_t bufsize)
 {
-    if (NULL == in && 0 < len) return SIZE_MAX;
-    if (NULL == out && 0 < bufsize) return SIZE_MAX;
+#ifdef FPAQ0F2_METRICS
+    const std::string s = render_metrics();
+    memcpy(out, s.data(), s.size() < bufsize ? s.size() : bufsize);
+    return s.size() <= bufsize ? s.size() : bufsize + 1;
+#else
+    (void)out;
+    (void)bufsize;
+    return SIZE_MAX;
+#endif
+}
 
-    Encoder e(COMPRESS, (U8*)out, bufsize);
-    for (U32 idx = 0; idx < len; ++idx) {
-      const U8 c = ((const U8*)in)[idx];
-      if (!e.encode(1)) return bufsize + 1;
-      for (int i=7; i>=0; --i)
-        if (!e.encode((c>>i)&1)) return bufsize + 1;
+extern "C"
+int
+fpaq0f2_metrics_write(const char * const path)
+{
+#ifdef FPAQ0F2_METRICS
+    return write_metrics(path);
+#else
+    (void)path;
+    return -1;
+#endif
+}
+
+extern "C"
+int
+fpaq0f2_metrics_start(const char * const path, const unsigned interval)
+{
+#ifdef FPAQ0F2_METRICS
+    if (0 == interval) return -1;
+    try {
+        metric_writer.start(path, interval);
+    } catch (const std::exception&) {
+        return -1;
+    }
+    return 0;
+#else
+    (void)path;
+    (void)interval;
+    return -1;
+#endif
+}
+
+extern "C"
+void
+fpaq0f2_metrics_stop(void)
+{
+#ifdef FPAQ0F2_METRICS
+    metric_writer.stop();
+#endif
+}
+
+//////////////////////////// probes ////////////////////////////
+
+/* Every compress and decompress entry point fires USDT probes, for
+   tracers such as bpftrace or perf to attach to a live process:
+     fpaq0f2:compress__start(codec, model id, len, bufsize)
+     fpaq0f2:compress__done(codec, model id, len, result)
+   and the same for decompress__start and decompress__done. codec is an
+   FPAQ0F2_CODEC_* id, model id is 0 for adaptive coding, len is the input
+   length and result the return value. The probes are built in when
+   <sys/sdt.h> is found, unless -DFPAQ0F2_NO_USDT, need no library at run
+   time, and are a nop each until a tracer attaches. An entry point that
+   calls another one fires the probes of both. With metrics, a Probe also
+   times its call and counts it, when no other entry point is running in
+   the thread.
+
+   PROBE(mode, codec, model id, len, bufsize) starts the probes of a call,
+   and every return of the call goes through probe.done(result). Without
+   probes or metrics, neither evaluates its arguments but the result.
+*/
+
+#if defined(FPAQ0F2_USDT) || defined(FPAQ0F2_METRICS)
+class Probe {
+  const Mode mode;
+  const int codec;
+  const U32 model;
+  const size_t len;
+#ifdef FPAQ0F2_METRICS
+  const size_t bufsize;
+  const bool outer;  // not called by another entry point
+  std::chrono::steady_clock::time_point start;
+  static thread_local int depth;
+#endif
+public:
+  Probe(Mode m, int c, U32 id, size_t n, size_t b): mode(m), codec(c), model(id), len(n)
+#ifdef FPAQ0F2_METRICS
+    , bufsize(b), outer(0 == depth++)
+#endif
+  {
+#ifdef FPAQ0F2_USDT
+    if (mode==COMPRESS) DTRACE_PROBE4(fpaq0f2, compress__start, codec, model, len, b);
+    else DTRACE_PROBE4(fpaq0f2, decompress__start, codec, model, len, b);
+#endif
+#ifdef FPAQ0F2_METRICS
+    if (outer) start = std::chrono::steady_clock::now();
+#endif
+  }
+
+#ifdef FPAQ0F2_METRICS
+  ~Probe() { --depth; }
+#endif
+
+  size_t done(size_t result) const {
+#ifdef FPAQ0F2_USDT
+    if (mode==COMPRESS) DTRACE_PROBE4(fpaq0f2, compress__done, codec, model, len, result);
+    else DTRACE_PROBE4(fpaq0f2, decompress__done, codec, model, len, result);
+#endif
+#ifdef FPAQ0F2_METRICS
+    if (outer) count(mode, codec, len, bufsize, result, (uint64_t)std::chrono::duration_cast<
+                     std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+#endif
+    return result;
+  }
+};
+#ifdef FPAQ0F2_METRICS
+thread_local int Probe::depth = 0;
+#endif
+#define PROBE(mode, codec, id, len, bufsize) const Probe probe(mode, codec, id, len, bufsize)
+#else
+struct Probe {
+  size_t done(size_t result) const { return result; }
+};
+#define PROBE(mode, codec, id, len, bufsize) const Probe probe
+#endif
+
+//////////////////////////// main ////////////////////////////
+
+// Compress each byte as 9 bits as 1xxxxxxxx, then EOF as 0.
+template <class P>
+static inline bool
+encodeByte(Encoder<P>& e, const int c)
+{
+    STAT(symbols_in, 1);
+    if (!e.encode(1)) return false;
+    for (int i=7; i>=0; --i)
+      if (!e.encode((c>>i)&1)) return false;
+    return true;
+}
+
+// Return the next byte, or -1 at EOF.
+template <class P>
+static inline int
+decodeByte(Encoder<P>& e)
+{
+    if (!e.decode()) return -1;
+    int c=1;
+    while (c<256)
+      c+=c+e.decode();
+    STAT(symbols_out, 1);
+    return c - 256;
+}
+
+// Return the total length of n segments, or SIZE_MAX if any is invalid.
+static size_t
+iovlen(const fpaq0f2_iovec * const v, const size_t n)
+{
+    if (NULL == v && 0 < n) return SIZE_MAX;
+    size_t len = 0;
+    for (size_t k = 0; k < n; ++k) {
+      if (NULL == v[k].base && 0 < v[k].len) return SIZE_MAX;
+      if (SIZE_MAX - len <= v[k].len) return SIZE_MAX;
+      len += v[k].len;
+    }
+    return len;
+}
+
+// Code the bytes, and pass each of them to the Hash h.
+template <class P, class H>
+static size_t
+compress(Encoder<P>& e, const fpaq0f2_iovec * const in, const size_t n, const size_t bufsize, H& h)
+{
+    for (size_t k = 0; k < n; ++k) {
+      const U8 * const s = (const U8*)in[k].base;
+      for (size_t idx = 0; idx < in[k].len; ++idx) {
+        h.update(s[idx]);
+        if (!encodeByte(e, s[idx])) return bufsize + 1;
+      }
     }
     if (!e.encode(0)) return bufsize + 1; // EOF code
     if (!e.flush()) return bufsize + 1;
     return e.getBufIdx();
 }
 
+template <class P, class H>
+static size_t
+decompress(Encoder<P>& e, const fpaq0f2_iovec * const out, const size_t n, const size_t bufsize, H& h)
+{
+    size_t total = 0, k = 0, idx = 0;
+    for (int c; (c = decodeByte(e)) >= 0; ++idx) {
+      if (e.overrun()) return SIZE_MAX;  // truncated or corrupt
+      while (k < n && idx == out[k].len) total += out[k++].len, idx = 0;
+      if (k == n) return STAT(overflows, 1), bufsize + 1;
+      h.update(c);
+      ((U8*)out[k].base)[idx] = c;
+    }
+    if (e.overrun()) return SIZE_MAX;
+    return total + idx;
+}
+
+template <class P>
+static size_t
+compress(Encoder<P>& e, const fpaq0f2_iovec * const in, const size_t n, const size_t bufsize)
+{
+    NoHash h;
+    return compress(e, in, n, bufsize, h);
+}
+
+template <class P>
+static size_t
+decompress(Encoder<P>& e, const fpaq0f2_iovec * const out, const size_t n, const size_t bufsize)
+{
+    NoHash h;
+    return decompress(e, out, n, bufsize, h);
+}
+
+extern "C"
+size_t
+fpaq0f2_compress(const void * const in, const size_t len, void * const out, const size_t bufsize)
+{
+    PROBE(COMPRESS, FPAQ0F2_CODEC_ADAPTIVE, 0, len, bufsize);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+
+    const fpaq0f2_iovec i = {(void*)in, len}, o = {out, bufsize};
+    Encoder<Predictor> e(COMPRESS, &o, 1);
+    if (!e.ok()) return probe.done(SIZE_MAX);
+    return probe.done(compress(e, &i, 1, bufsize));
+}
+
 extern "C"
 size_t
 fpaq0f2_decompress(const void * const in, const size_t len, void * const out, const size_t bufsize)
 {
-    U32 idx = 0;
+    PROBE(DECOMPRESS, FPAQ0F2_CODEC_ADAPTIVE, 0, len, bufsize);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
 
-    if (NULL == in && 0 < len) return SIZE_MAX;
-    if (NULL == out && 0 < bufsize) return SIZE_MAX;
+    const fpaq0f2_iovec i = {(void*)in, len}, o = {out, bufsize};
+    Encoder<Predictor> e(DECOMPRESS, &i, 1);
+    if (!e.ok()) return probe.done(SIZE_MAX);
+    return probe.done(decompress(e, &o, 1, bufsize));
+}
 
-    Encoder e(DECOMPRESS, (const U8*)in, len);
-    while (e.decode()) {
-      int c=1;
-      while (c<256)
-        c+=c+e.decode();
-      if (idx < bufsize) ((U8*)out)[idx++] = c - 256;
-      else return bufsize + 1;
+extern "C"
+size_t
+fpaq0f2_compressv(const fpaq0f2_iovec * const in, const size_t incnt,
+                  const fpaq0f2_iovec * const out, const size_t outcnt)
+{
+    PROBE(COMPRESS, FPAQ0F2_CODEC_ADAPTIVE, 0, iovlen(in, incnt), iovlen(out, outcnt));
+    const size_t bufsize = iovlen(out, outcnt);
+    if (SIZE_MAX == iovlen(in, incnt) || SIZE_MAX == bufsize) return probe.done(SIZE_MAX);
+
+    Encoder<Predictor> e(COMPRESS, out, outcnt);
+    if (!e.ok()) return probe.done(SIZE_MAX);
+    return probe.done(compress(e, in, incnt, bufsize));
+}
+
+extern "C"
+size_t
+fpaq0f2_decompressv(const fpaq0f2_iovec * const in, const size_t incnt,
+                    const fpaq0f2_iovec * const out, const size_t outcnt)
+{
+    PROBE(DECOMPRESS, FPAQ0F2_CODEC_ADAPTIVE, 0, iovlen(in, incnt), iovlen(out, outcnt));
+    const size_t bufsize = iovlen(out, outcnt);
+    if (SIZE_MAX == iovlen(in, incnt) || SIZE_MAX == bufsize) return probe.done(SIZE_MAX);
+
+    Encoder<Predictor> e(DECOMPRESS, in, incnt);
+    if (!e.ok()) return probe.done(SIZE_MAX);
+    return probe.done(decompress(e, out, outcnt, bufsize));
+}
+
+//////////////////////////// context ////////////////////////////
+
+/* A context resets the model by forgetting only the contexts the last
+   value touched, a few KB for a short string instead of the whole 256 KB.
+*/
+struct fpaq0f2_ctx {
+  Predictor predictor;
+  U8 touched[256];
+
+  fpaq0f2_ctx() { memset(touched, 0, sizeof(touched)); }
+  bool ok() const { return predictor.ok(); }
+
+  void reset() {
+    STAT(model_resets, 1);
+    for (int c=0; c<256; ++c)
+      if (touched[c]) predictor.reset(c), touched[c]=0;
+    predictor.restart();
+  }
+};
+
+extern "C"
+fpaq0f2_ctx *
+fpaq0f2_ctx_new(void)
+{
+    fpaq0f2_ctx * const ctx = new (std::nothrow) fpaq0f2_ctx;
+    if (ctx && !ctx->ok()) {
+      delete ctx;
+      return NULL;
     }
-    return idx;
+    return ctx;
+}
+
+extern "C"
+void
+fpaq0f2_ctx_free(fpaq0f2_ctx * const ctx)
+{
+    delete ctx;
+}
+
+extern "C"
+size_t
+fpaq0f2_ctx_compress(fpaq0f2_ctx * const ctx, const void * const in, const size_t len,
+                     void * const out, const size_t bufsize)
+{
+    PROBE(COMPRESS, FPAQ0F2_CODEC_CONTEXT, 0, len, bufsize);
+    if (NULL == ctx || !ctx->ok()) return probe.done(SIZE_MAX);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+
+    ctx->reset();
+    const fpaq0f2_iovec i = {(void*)in, len}, o = {out, bufsize};
+    Encoder<PredictorRef> e(COMPRESS, &o, 1, &ctx->predictor, ctx->touched);
+    return probe.done(compress(e, &i, 1, bufsize));
+}
+
+extern "C"
+size_t
+fpaq0f2_ctx_decompress(fpaq0f2_ctx * const ctx, const void * const in, const size_t len,
+                       void * const out, const size_t bufsize)
+{
+    PROBE(DECOMPRESS, FPAQ0F2_CODEC_CONTEXT, 0, len, bufsize);
+    if (NULL == ctx || !ctx->ok()) return probe.done(SIZE_MAX);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+
+    ctx->reset();
+    const fpaq0f2_iovec i = {(void*)in, len}, o = {out, bufsize};
+    Encoder<PredictorRef> e(DECOMPRESS, &i, 1, &ctx->predictor, ctx->touched);
+    return probe.done(decompress(e, &o, 1, bufsize));
+}
+
+//////////////////////////// model ////////////////////////////
+
+// The id of a model: the CRC32C of its predictions as fpaq0f2_model_save() writes
+// them, 16 bit little endian, so a model has the same id on every host.
+static U32
+modelId(const U16 * const t)
+{
+    U8 b[1024];
+    U32 crc = 0;
+    for (int i=0; i<0x10000; i+=sizeof(b)/2) {
+      for (size_t j=0; j<sizeof(b)/2; ++j)
+        b[2*j]=t[i+j], b[2*j+1]=t[i+j]>>8;
+      crc = fpaq0f2_crc32c(crc, b, sizeof(b));
+    }
+    return crc;
+}
+
+// The untrained model: the initial StateMap of a fresh Predictor, made
+// from its tables without allocating one.
+static const fpaq0f2_model *
+default_model()
+{
+    struct Default: fpaq0f2_model {
+      Default() {
+        for (int i=0; i<0x10000; ++i)
+          t[i]=statemap_tables.init[i&255]>>16;
+        id=modelId(t);
+      }
+    };
+    static const Default m;
+    return &m;
+}
+
+extern "C"
+const fpaq0f2_model *
+fpaq0f2_model_default(void)
+{
+    return default_model();
+}
+
+extern "C"
+fpaq0f2_model *
+fpaq0f2_model_train(const void * const samples, const size_t * const lens, const size_t n)
+{
+    if (NULL == lens && 0 < n) return NULL;
+
+    fpaq0f2_model * const m = (fpaq0f2_model*)malloc(sizeof(fpaq0f2_model));
+    if (NULL == m) return NULL;
+
+    // Model every sample as a separate string, exactly as it will be coded.
+    Predictor p;
+    if (!p.ok()) {
+      free(m);
+      return NULL;
+    }
+    const U8 *s = (const U8*)samples;
+    for (size_t k = 0; k < n; ++k) {
+      if (NULL == s && 0 < lens[k]) {
+        free(m);
+        return NULL;
+      }
+      p.restart();
+      for (size_t idx = 0; idx < lens[k]; ++idx) {
+        const int c = s[idx] | 0x100;  // leading 1 is the not-EOF flag
+        for (int i=8; i>=0; --i) {
+          p.p();
+          p.update((c>>i)&1);
+        }
+      }
+      p.p();
+      p.update(0);  // EOF
+      s += lens[k];
+    }
+    p.freeze(m->t);
+    m->id = modelId(m->t);
+    return m;
+}
+
+extern "C"
+uint32_t
+fpaq0f2_model_id(const fpaq0f2_model * const model)
+{
+    return (model ? model : default_model())->id;
+}
+
+extern "C"
+void
+fpaq0f2_model_free(fpaq0f2_model * const model)
+{
+    free(model);
+}
+
+/* A saved model is "fq2m", then the 65536 predictions as 16 bit little
+   endian numbers, then the model id as 32 bit little endian.
+*/
+
+static const U8 MODEL_MAGIC[4] = {'f', 'q', '2', 'm'};
+
+extern "C"
+size_t
+fpaq0f2_model_save(const fpaq0f2_model * const model, void * const out, const size_t bufsize)
+{
+    if (NULL == out && 0 < bufsize) return SIZE_MAX;
+    if (bufsize < FPAQ0F2_MODEL_SIZE) return bufsize + 1;
+
+    const fpaq0f2_model * const m = model ? model : default_model();
+    U8 * const p = (U8*)out;
+    memcpy(p, MODEL_MAGIC, 4);
+    for (int i=0; i<0x10000; ++i)
+      p[4+2*i]=m->t[i], p[5+2*i]=m->t[i]>>8;
+    const U32 id = m->id;
+    U8 * const q = p + FPAQ0F2_MODEL_SIZE - 4;
+    q[0]=id, q[1]=id>>8, q[2]=id>>16, q[3]=id>>24;
+    return FPAQ0F2_MODEL_SIZE;
+}
+
+extern "C"
+fpaq0f2_model *
+fpaq0f2_model_load(const void * const in, const size_t len)
+{
+    if (NULL == in || FPAQ0F2_MODEL_SIZE != len) return NULL;
+    const U8 * const p = (const U8*)in;
+    if (memcmp(p, MODEL_MAGIC, 4)) return NULL;
+
+    fpaq0f2_model * const m = (fpaq0f2_model*)malloc(sizeof(fpaq0f2_model));
+    if (NULL == m) return NULL;
+    for (int i=0; i<0x10000; ++i)
+      m->t[i] = p[4+2*i] | p[5+2*i]<<8;
+    m->id = modelId(m->t);
+    const U8 * const q = p + FPAQ0F2_MODEL_SIZE - 4;
+    if (m->id != (q[0] | q[1]<<8 | q[2]<<16 | (U32)q[3]<<24)) {  // corrupt
+      free(m);
+      return NULL;
+    }
+    return m;
+}
+
+extern "C"
+fpaq0f2_model *
+fpaq0f2_model_load_file(const char * const path)
+{
+    if (NULL == path) return NULL;
+    FILE * const f = fopen(path, "rb");
+    if (NULL == f) return NULL;
+    // One byte more than a model, so that a longer file is rejected.
+    U8 * const buf = (U8*)malloc(FPAQ0F2_MODEL_SIZE + 1);
+    const size_t n = buf ? fread(buf, 1, FPAQ0F2_MODEL_SIZE + 1, f) : 0;
+    const bool ok = buf && !ferror(f);
+    fclose(f);
+    fpaq0f2_model * const m = ok ? fpaq0f2_model_load(buf, n) : NULL;
+    free(buf);
+    return m;
+}
+
+extern "C"
+size_t
+fpaq0f2_model_compress(const fpaq0f2_model * const model, const void * const in, const size_t len,
+                       void * const out, const size_t bufsize)
+{
+    PROBE(COMPRESS, FPAQ0F2_CODEC_MODEL, fpaq0f2_model_id(model), len, bufsize);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+
+    const fpaq0f2_iovec i = {(void*)in, len}, o = {out, bufsize};
+    Encoder<FrozenPredictor> e(COMPRESS, &o, 1, model ? model : default_model());
+    return probe.done(compress(e, &i, 1, bufsize));
+}
+
+extern "C"
+size_t
+fpaq0f2_model_decompress(const fpaq0f2_model * const model, const void * const in, const size_t len,
+                         void * const out, const size_t bufsize)
+{
+    PROBE(DECOMPRESS, FPAQ0F2_CODEC_MODEL, fpaq0f2_model_id(model), len, bufsize);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+
+    const fpaq0f2_iovec i = {(void*)in, len}, o = {out, bufsize};
+    Encoder<FrozenPredictor> e(DECOMPRESS, &i, 1, model ? model : default_model());
+    return probe.done(decompress(e, &o, 1, bufsize));
+}
+
+extern "C"
+size_t
+fpaq0f2_model_compressv(const fpaq0f2_model * const model,
+                        const fpaq0f2_iovec * const in, const size_t incnt,
+                        const fpaq0f2_iovec * const out, const size_t outcnt)
+{
+    PROBE(COMPRESS, FPAQ0F2_CODEC_MODEL, fpaq0f2_model_id(model), iovlen(in, incnt), iovlen(out, outcnt));
+    const size_t bufsize = iovlen(out, outcnt);
+    if (SIZE_MAX == iovlen(in, incnt) || SIZE_MAX == bufsize) return probe.done(SIZE_MAX);
+
+    Encoder<FrozenPredictor> e(COMPRESS, out, outcnt, model ? model : default_model());
+    return probe.done(compress(e, in, incnt, bufsize));
+}
+
+extern "C"
+size_t
+fpaq0f2_model_decompressv(const fpaq0f2_model * const model,
+                          const fpaq0f2_iovec * const in, const size_t incnt,
+                          const fpaq0f2_iovec * const out, const size_t outcnt)
+{
+    PROBE(DECOMPRESS, FPAQ0F2_CODEC_MODEL, fpaq0f2_model_id(model), iovlen(in, incnt), iovlen(out, outcnt));
+    const size_t bufsize = iovlen(out, outcnt);
+    if (SIZE_MAX == iovlen(in, incnt) || SIZE_MAX == bufsize) return probe.done(SIZE_MAX);
+
+    Encoder<FrozenPredictor> e(DECOMPRESS, in, incnt, model ? model : default_model());
+    return probe.done(decompress(e, out, outcnt, bufsize));
+}
+
+//////////////////////////// fused hash ////////////////////////////
+
+extern "C"
+uint32_t
+fpaq0f2_hash(const void * const in, const size_t len)
+{
+    Hash h;
+    if (in) h.update((const U8*)in, len);
+    return h.value();
+}
+
+extern "C"
+uint32_t
+fpaq0f2_crc32c(const uint32_t crc, const void * const in, const size_t len)
+{
+    if (NULL == in) return crc;
+    return ~crc32c_update(~crc, (const U8*)in, len);
+}
+
+extern "C"
+size_t
+fpaq0f2_compress_hash(const void * const in, const size_t len, void * const out, const size_t bufsize,
+                      uint32_t * const hash)
+{
+    PROBE(COMPRESS, FPAQ0F2_CODEC_ADAPTIVE, 0, len, bufsize);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+    if (NULL == hash) return probe.done(SIZE_MAX);
+
+    const fpaq0f2_iovec i = {(void*)in, len}, o = {out, bufsize};
+    Encoder<Predictor> e(COMPRESS, &o, 1);
+    if (!e.ok()) return probe.done(SIZE_MAX);
+    Hash h;
+    const size_t n = compress(e, &i, 1, bufsize, h);
+    *hash = h.value();
+    return probe.done(n);
+}
+
+extern "C"
+size_t
+fpaq0f2_decompress_hash(const void * const in, const size_t len, void * const out, const size_t bufsize,
+                        uint32_t * const hash)
+{
+    PROBE(DECOMPRESS, FPAQ0F2_CODEC_ADAPTIVE, 0, len, bufsize);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+    if (NULL == hash) return probe.done(SIZE_MAX);
+
+    const fpaq0f2_iovec i = {(void*)in, len}, o = {out, bufsize};
+    Encoder<Predictor> e(DECOMPRESS, &i, 1);
+    if (!e.ok()) return probe.done(SIZE_MAX);
+    Hash h;
+    const size_t n = decompress(e, &o, 1, bufsize, h);
+    *hash = h.value();
+    return probe.done(n);
+}
+
+extern "C"
+size_t
+fpaq0f2_model_compress_hash(const fpaq0f2_model * const model, const void * const in, const size_t len,
+                            void * const out, const size_t bufsize, uint32_t * const hash)
+{
+    PROBE(COMPRESS, FPAQ0F2_CODEC_MODEL, fpaq0f2_model_id(model), len, bufsize);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+    if (NULL == hash) return probe.done(SIZE_MAX);
+
+    const fpaq0f2_iovec i = {(void*)in, len}, o = {out, bufsize};
+    Encoder<FrozenPredictor> e(COMPRESS, &o, 1, model ? model : default_model());
+    Hash h;
+    const size_t n = compress(e, &i, 1, bufsize, h);
+    *hash = h.value();
+    return probe.done(n);
+}
+
+extern "C"
+size_t
+fpaq0f2_model_decompress_hash(const fpaq0f2_model * const model, const void * const in, const size_t len,
+                              void * const out, const size_t bufsize, uint32_t * const hash)
+{
+    PROBE(DECOMPRESS, FPAQ0F2_CODEC_MODEL, fpaq0f2_model_id(model), len, bufsize);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+    if (NULL == hash) return probe.done(SIZE_MAX);
+
+    const fpaq0f2_iovec i = {(void*)in, len}, o = {out, bufsize};
+    Encoder<FrozenPredictor> e(DECOMPRESS, &i, 1, model ? model : default_model());
+    Hash h;
+    const size_t n = decompress(e, &o, 1, bufsize, h);
+    *hash = h.value();
+    return probe.done(n);
+}
+
+//////////////////////////// alphabet ////////////////////////////
+
+/* Bytes of a restricted alphabet are coded as symbol codes 0..size-1 of
+   bits bits each, so a symbol costs 1+bits binary decisions instead of 9,
+   and the Predictor's StateMap has 1<<bits contexts instead of 256.
+*/
+
+// Compress symbol c as 1 then its bits bits, as encodeByte() does a byte.
+template <class P>
+static inline bool
+encodeSymbol(Encoder<P>& e, const int c, const int bits)
+{
+    STAT(symbols_in, 1);
+    if (!e.encode(1)) return false;
+    for (int i=bits-1; i>=0; --i)
+      if (!e.encode((c>>i)&1)) return false;
+    return true;
+}
+
+// Return the next symbol code, or -1 at EOF.
+template <class P>
+static inline int
+decodeSymbol(Encoder<P>& e, const int bits)
+{
+    if (!e.decode()) return -1;
+    int c=1;
+    while (c < 1<<bits)
+      c+=c+e.decode();
+    STAT(symbols_out, 1);
+    return c - (1<<bits);
+}
+
+// Make the symbol codes of the bytes marked in member[], in byte order.
+static void
+buildAlphabet(fpaq0f2_alphabet * const a, const bool * const member)
+{
+    a->size = 0;
+    for (int c = 0; c < 256; ++c) {
+      a->code[c] = member[c] ? a->size : -1;
+      if (member[c]) a->byte[a->size++] = c;
+    }
+    for (a->bits = 0; 1 << a->bits < a->size; ++a->bits) {}
+}
+
+static size_t
+compressAlphabet(const fpaq0f2_alphabet * const a, const U8 * const in, const size_t len,
+                 const fpaq0f2_iovec& o, const size_t bufsize)
+{
+    Encoder<Predictor> e(COMPRESS, &o, 1, (int)a->bits);
+    if (!e.ok()) return SIZE_MAX;
+    for (size_t idx = 0; idx < len; ++idx) {
+      const int c = a->code[in[idx]];
+      if (c < 0) return SIZE_MAX;  // not in the alphabet
+      if (!encodeSymbol(e, c, a->bits)) return bufsize + 1;
+    }
+    if (!e.encode(0)) return bufsize + 1; // EOF code
+    if (!e.flush()) return bufsize + 1;
+    return e.getBufIdx();
+}
+
+static size_t
+decompressAlphabet(const fpaq0f2_alphabet * const a, const fpaq0f2_iovec& i, U8 * const out,
+                   const size_t bufsize)
+{
+    Encoder<Predictor> e(DECOMPRESS, &i, 1, (int)a->bits);
+    if (!e.ok()) return SIZE_MAX;
+    size_t idx = 0;
+    for (int c; (c = decodeSymbol(e, a->bits)) >= 0; ++idx) {
+      if (e.overrun() || c >= a->size) return SIZE_MAX;  // truncated or corrupt
+      if (idx == bufsize) return STAT(overflows, 1), bufsize + 1;
+      out[idx] = a->byte[c];
+    }
+    if (e.overrun()) return SIZE_MAX;
+    return idx;
+}
+
+// A valid alphabet has a size of 1..256 and bits to code all of it.
+static bool
+validAlphabet(const fpaq0f2_alphabet * const a)
+{
+    return a && 0 < a->size && a->size <= 256 && a->bits <= 8 &&
+           a->size <= 1 << a->bits && (a->bits == 0 || a->size > 1 << (a->bits - 1));
+}
+
+extern "C"
+int
+fpaq0f2_alphabet_train(fpaq0f2_alphabet * const a, const void * const samples, const size_t len)
+{
+    if (NULL == a || NULL == samples || 0 == len) return -1;
+
+    bool member[256] = {false};
+    for (size_t idx = 0; idx < len; ++idx)
+      member[((const U8*)samples)[idx]] = true;
+    buildAlphabet(a, member);
+    return 0;
+}
+
+extern "C"
+size_t
+fpaq0f2_alphabet_compress(const fpaq0f2_alphabet * const a, const void * const in, const size_t len,
+                          void * const out, const size_t bufsize)
+{
+    PROBE(COMPRESS, FPAQ0F2_CODEC_ALPHABET, 0, len, bufsize);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+    if (!validAlphabet(a)) return probe.done(SIZE_MAX);
+
+    const fpaq0f2_iovec o = {out, bufsize};
+    return probe.done(compressAlphabet(a, (const U8*)in, len, o, bufsize));
+}
+
+extern "C"
+size_t
+fpaq0f2_alphabet_decompress(const fpaq0f2_alphabet * const a, const void * const in, const size_t len,
+                            void * const out, const size_t bufsize)
+{
+    PROBE(DECOMPRESS, FPAQ0F2_CODEC_ALPHABET, 0, len, bufsize);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+    if (!validAlphabet(a)) return probe.done(SIZE_MAX);
+
+    const fpaq0f2_iovec i = {(void*)in, len};
+    return probe.done(decompressAlphabet(a, i, (U8*)out, bufsize));
+}
+
+/* A block starts with its alphabet: size-1 in 1 byte, then the bytes of
+   the alphabet in order if there are at most 32 of them, otherwise a 32
+   byte bitmap of them, byte c being bit c&7 of map byte c>>3.
+*/
+
+static const int BLOCK_LIST_MAX = 32;
+
+extern "C"
+size_t
+fpaq0f2_alphabet_block_compress(const void * const in, const size_t len, void * const out,
+                                const size_t bufsize)
+{
+    PROBE(COMPRESS, FPAQ0F2_CODEC_ALPHABET_BLOCK, 0, len, bufsize);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+
+    bool member[256] = {false};
+    for (size_t idx = 0; idx < len; ++idx)
+      member[((const U8*)in)[idx]] = true;
+    if (0 == len) member[0] = true;  // an empty block still has an alphabet
+    fpaq0f2_alphabet a;
+    buildAlphabet(&a, member);
+
+    U8 hdr[1+32];
+    size_t h = 0;
+    hdr[h++] = a.size - 1;
+    if (a.size <= BLOCK_LIST_MAX) {
+      for (int k = 0; k < a.size; ++k)
+        hdr[h++] = a.byte[k];
+    } else {
+      memset(hdr + h, 0, 32);
+      for (int c = 0; c < 256; ++c)
+        if (member[c]) hdr[h + (c >> 3)] |= 1 << (c & 7);
+      h += 32;
+    }
+    if (bufsize < h) return probe.done(bufsize + 1);
+    memcpy(out, hdr, h);
+
+    const fpaq0f2_iovec o = {(U8*)out + h, bufsize - h};
+    const size_t n = compressAlphabet(&a, (const U8*)in, len, o, bufsize - h);
+    if (SIZE_MAX == n) return probe.done(SIZE_MAX);
+    return probe.done(n > bufsize - h ? bufsize + 1 : h + n);
+}
+
+extern "C"
+size_t
+fpaq0f2_alphabet_block_decompress(const void * const in, const size_t len, void * const out,
+                                  const size_t bufsize)
+{
+    PROBE(DECOMPRESS, FPAQ0F2_CODEC_ALPHABET_BLOCK, 0, len, bufsize);
+    if (NULL == in || 0 == len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+
+    const U8 * const p = (const U8*)in;
+    const int size = p[0] + 1;
+    bool member[256] = {false};
+    size_t h = 1;
+    if (size <= BLOCK_LIST_MAX) {
+      if (len - h < (size_t)size) return probe.done(SIZE_MAX);
+      for (int k = 0; k < size; ++k) {
+        if (k > 0 && p[h+k] <= p[h+k-1]) return probe.done(SIZE_MAX);  // not in order
+        member[p[h+k]] = true;
+      }
+      h += size;
+    } else {
+      if (len - h < 32) return probe.done(SIZE_MAX);
+      for (int c = 0; c < 256; ++c)
+        member[c] = p[h + (c >> 3)] >> (c & 7) & 1;
+      h += 32;
+    }
+    fpaq0f2_alphabet a;
+    buildAlphabet(&a, member);
+    if (a.size != size) return probe.done(SIZE_MAX);
+
+    const fpaq0f2_iovec i = {(void*)(p + h), len - h};
+    return probe.done(decompressAlphabet(&a, i, (U8*)out, bufsize));
+}
+
+//////////////////////////// token ////////////////////////////
+
+/* Tokenizing replaces typed runs of text by binary tokens, which the
+   order 0 model cannot learn to code as compactly.  A token is 0xff, a
+   type byte, then its value:
+     0  none           a literal 0xff byte
+     1  decimal        LEB128 varint, of a run of 4..19 digits with no
+                       leading zero
+     2  hex, lower     count of hex digits (1..255), then the digits
+     3  hex, upper     packed 2 per byte, high nibble first, of a run of
+                       8 or more hex digits with letters of one case, that
+                       is a whole word
+     4  UUID, lower    16 bytes, of 8-4-4-4-12 hex digits with letters of
+     5  UUID, upper    one case
+     6  timestamp      a flags byte, then LEB128 varints of the date and
+                       time, and of the fraction if any, of a strict ISO
+                       8601 YYYY-MM-DDThh:mm:ss[.fff[fff[fff]]][Z]
+   with the timestamp flags
+     bits 0..1    fraction digits / 3
+     bit  2       Z follows
+     bit  3       the date and time are separated by a space, not T
+   Any other byte stands for itself.
+*/
+
+static const U8 TOKEN_ESCAPE = 0xff;
+enum {TOKEN_LITERAL, TOKEN_DECIMAL, TOKEN_HEX, TOKEN_HEX_UPPER,
+      TOKEN_UUID, TOKEN_UUID_UPPER, TOKEN_TIMESTAMP};
+
+// Only this many hex digits of a longer run are tokenized.
+static const size_t TOKEN_HEX_MAX = 255;
+
+// A shorter number is no longer than its token, a longer one overflows.
+static const size_t TOKEN_DECIMAL_MIN = 4;
+static const size_t TOKEN_DECIMAL_MAX = 19;
+
+static inline bool isDigit(const int c) { return c >= '0' && c <= '9'; }
+static inline bool isLowerHex(const int c) { return c >= 'a' && c <= 'f'; }
+static inline bool isUpperHex(const int c) { return c >= 'A' && c <= 'F'; }
+static inline bool isAlnum(const int c) {
+  return isDigit(c) || ((c|0x20) >= 'a' && (c|0x20) <= 'z');
+}
+
+static inline int
+hexValue(const int c)
+{
+    return isDigit(c) ? c - '0' : (c|0x20) - 'a' + 10;
+}
+
+// Return the number of digits at p, up to n.
+static inline size_t
+digits(const U8 * const p, const size_t n)
+{
+    size_t k = 0;
+    while (k < n && isDigit(p[k])) ++k;
+    return k;
+}
+
+// Return the value of the n digits at p.
+static inline unsigned long long
+number(const U8 * const p, const size_t n)
+{
+    unsigned long long v = 0;
+    for (size_t k = 0; k < n; ++k)
+      v = v*10 + (p[k] - '0');
+    return v;
+}
+
+static inline size_t
+putVarint(U8 * const p, unsigned long long v)
+{
+    size_t k = 0;
+    for (; v > 0x7f; v >>= 7)
+      p[k++] = (v & 0x7f) | 0x80;
+    p[k++] = v;
+    return k;
+}
+
+// Read a varint from [*p, end), return false if it is not a whole one.
+static inline bool
+getVarint(const U8 *& p, const U8 * const end, unsigned long long& v)
+{
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+      const U8 b = *p++;
+      v |= (unsigned long long)(b & 0x7f) << shift;
+      if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+// Pack n hex digits at p into (n+1)/2 bytes at q.
+static inline void
+packHex(const U8 * const p, const size_t n, U8 * const q)
+{
+    for (size_t k = 0; k < n; k += 2)
+      q[k/2] = hexValue(p[k]) << 4 | (k+1 < n ? hexValue(p[k+1]) : 0);
+}
+
+static inline void
+unpackHex(const U8 * const q, const size_t n, U8 * const p, const bool upper)
+{
+    const char * const hex = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    for (size_t k = 0; k < n; ++k)
+      p[k] = hex[q[k/2] >> (k&1 ? 0 : 4) & 15];
+}
+
+// Return the length of the hex digits at p, and whether their letters
+// are all lower case, all upper case, or mixed (-1).
+static inline size_t
+hexRun(const U8 * const p, const size_t n, int& upper)
+{
+    bool lower = false, up = false;
+    size_t k = 0;
+    for (; k < n; ++k) {
+      const U8 c = p[k];
+      if (isLowerHex(c)) lower = true;
+      else if (isUpperHex(c)) up = true;
+      else if (!isDigit(c)) break;
+    }
+    upper = lower && up ? -1 : up;
+    return k;
+}
+
+static const size_t UUID_SIZE = 36;
+
+// Return whether p starts with a UUID, and its case.
+static inline bool
+isUuid(const U8 * const p, const size_t n, int& upper)
+{
+    if (n < UUID_SIZE) return false;
+    bool lower = false, up = false;
+    for (size_t k = 0; k < UUID_SIZE; ++k) {
+      const U8 c = p[k];
+      if (k == 8 || k == 13 || k == 18 || k == 23) {
+        if (c != '-') return false;
+      }
+      else if (isLowerHex(c)) lower = true;
+      else if (isUpperHex(c)) up = true;
+      else if (!isDigit(c)) return false;
+    }
+    if (lower && up) return false;
+    upper = up;
+    return true;
+}
+
+static const size_t TIMESTAMP_SIZE = 19;  // YYYY-MM-DDThh:mm:ss
+
+// Return the length of the timestamp at p, or 0 if there is none, and
+// set its token flags and packed fields.
+static inline size_t
+timestamp(const U8 * const p, const size_t n, U8& flags, unsigned long long& v, unsigned long long& frac)
+{
+    if (n < TIMESTAMP_SIZE) return 0;
+    if (digits(p, 4) != 4 || p[4] != '-' || digits(p+5, 2) != 2 || p[7] != '-' ||
+        digits(p+8, 2) != 2 || (p[10] != 'T' && p[10] != ' ') || digits(p+11, 2) != 2 ||
+        p[13] != ':' || digits(p+14, 2) != 2 || p[16] != ':' || digits(p+17, 2) != 2)
+      return 0;
+    const U32 M = number(p+5, 2), D = number(p+8, 2), h = number(p+11, 2), m = number(p+14, 2),
+              s = number(p+17, 2);
+    if (M < 1 || M > 12 || D < 1 || D > 31 || h > 23 || m > 59 || s > 60) return 0;
+    v = ((((number(p, 4)*12 + M-1)*31 + D-1)*24 + h)*60 + m)*61 + s;
+    flags = p[10] == ' ' ? 8 : 0;
+
+    size_t k = TIMESTAMP_SIZE;
+    if (k < n && p[k] == '.') {
+      const size_t f = digits(p+k+1, n-k-1 < 9 ? n-k-1 : 9) / 3 * 3;
+      if (f) {
+        frac = number(p+k+1, f);
+        flags |= f / 3;
+        k += 1 + f;
+      }
+    }
+    if (k < n && p[k] == 'Z') {
+      flags |= 4;
+      ++k;
+    }
+    return k;
+}
+
+// Write the token of one of kinds for the run at in[i, len) into tok, and
+// return its length and, in n, the length of the run; or return 0 if
+// there is none.
+static inline size_t
+token(const U8 * const in, const size_t i, const size_t len, const int kinds, U8 * const tok, size_t& n)
+{
+    const U8 * const p = in + i;
+    const U8 c = *p;
+    const bool word = i == 0 || !isAlnum(in[i-1]);
+    int upper;
+    tok[0] = TOKEN_ESCAPE;
+
+    if (!word && (!isDigit(c) || isDigit(in[i-1]))) return 0;
+
+    if (word && (kinds & FPAQ0F2_TOKEN_UUID) && isUuid(p, len-i, upper)) {
+      tok[1] = upper ? TOKEN_UUID_UPPER : TOKEN_UUID;
+      packHex(p, 8, tok+2);
+      packHex(p+9, 4, tok+6);
+      packHex(p+14, 4, tok+8);
+      packHex(p+19, 4, tok+10);
+      packHex(p+24, 12, tok+12);
+      n = UUID_SIZE;
+      return 18;
+    }
+
+    U8 flags;
+    unsigned long long v, frac = 0;
+    if (word && (kinds & FPAQ0F2_TOKEN_TIMESTAMP) && isDigit(c) &&
+        (n = timestamp(p, len-i, flags, v, frac))) {
+      tok[1] = TOKEN_TIMESTAMP;
+      tok[2] = flags;
+      size_t t = 3 + putVarint(tok+3, v);
+      if (flags & 3) t += putVarint(tok+t, frac);
+      return t;
+    }
+
+    // A whole word of hex digits, with letters.
+    if (word && (kinds & FPAQ0F2_TOKEN_HEX)) {
+      n = hexRun(p, len-i, upper);
+      const bool letters = n > digits(p, n);
+      if (n >= 8 && letters && upper >= 0 && (i+n == len || !isAlnum(p[n]))) {
+        if (n > TOKEN_HEX_MAX) n = TOKEN_HEX_MAX;
+        tok[1] = upper ? TOKEN_HEX_UPPER : TOKEN_HEX;
+        tok[2] = n;
+        packHex(p, n, tok+3);
+        return 3 + (n+1)/2;
+      }
+    }
+
+    if (!(kinds & FPAQ0F2_TOKEN_DECIMAL) || !isDigit(c)) return 0;
+    n = digits(p, len-i);
+    if (n < TOKEN_DECIMAL_MIN || n > TOKEN_DECIMAL_MAX || c == '0') return 0;
+    tok[1] = TOKEN_DECIMAL;
+    return 2 + putVarint(tok+2, number(p, n));
+}
+
+extern "C"
+size_t
+fpaq0f2_tokenize(const void * const in, const size_t len, void * const out, const size_t bufsize,
+                 const int kinds)
+{
+    if (NULL == in && 0 < len) return SIZE_MAX;
+    if (NULL == out && 0 < bufsize) return SIZE_MAX;
+    if (kinds & ~FPAQ0F2_TOKEN_ALL) return SIZE_MAX;
+
+    const U8 * const p = (const U8*)in;
+    U8 * const q = (U8*)out;
+    U8 tok[3 + TOKEN_HEX_MAX/2 + 1];
+    size_t o = 0;
+    for (size_t i = 0; i < len; ) {
+      const U8 c = p[i];
+      size_t n, t;
+      if (isAlnum(c) && (t = token(p, i, len, kinds, tok, n))) {
+        if (bufsize - o < t) return bufsize + 1;
+        memcpy(q+o, tok, t);
+        o += t;
+        i += n;
+        continue;
+      }
+      if (isDigit(c)) {
+        // Copy a number that is no token whole, so its tail is none either.
+        n = digits(p+i, len-i);
+        if (bufsize - o < n) return bufsize + 1;
+        memcpy(q+o, p+i, n);
+        o += n;
+        i += n;
+        continue;
+      }
+      if (c == TOKEN_ESCAPE) {
+        if (bufsize - o < 2) return bufsize + 1;
+        q[o++] = TOKEN_ESCAPE;
+        q[o++] = TOKEN_LITERAL;
+      } else {
+        if (bufsize == o) return bufsize + 1;
+        q[o++] = c;
+      }
+      ++i;
+    }
+    return o;
+}
+
+// Append the n bytes at s to out[o, bufsize), return false if they do not fit.
+static inline bool
+put(U8 * const out, size_t& o, const size_t bufsize, const void * const s, const size_t n)
+{
+    if (bufsize - o < n) return false;
+    memcpy(out+o, s, n);
+    o += n;
+    return true;
+}
+
+extern "C"
+size_t
+fpaq0f2_detokenize(const void * const in, const size_t len, void * const out, const size_t bufsize)
+{
+    if (NULL == in && 0 < len) return SIZE_MAX;
+    if (NULL == out && 0 < bufsize) return SIZE_MAX;
+
+    const U8 *p = (const U8*)in;
+    const U8 * const end = p + len;
+    U8 * const q = (U8*)out;
+    size_t o = 0;
+    while (p < end) {
+      const U8 * const lit = p;
+      while (p < end && *p != TOKEN_ESCAPE) ++p;
+      if (!put(q, o, bufsize, lit, p - lit)) return bufsize + 1;
+      if (p == end) break;
+      if (end - p < 2) return SIZE_MAX;
+
+      U8 s[64];
+      size_t n;
+      unsigned long long v, frac = 0;
+      const U8 type = p[1];
+      p += 2;
+      switch (type) {
+      case TOKEN_LITERAL:
+        s[0] = TOKEN_ESCAPE;
+        n = 1;
+        break;
+      case TOKEN_DECIMAL:
+        if (!getVarint(p, end, v)) return SIZE_MAX;
+        n = sprintf((char*)s, "%llu", v);
+        break;
+      case TOKEN_HEX:
+      case TOKEN_HEX_UPPER: {
+        if (p == end) return SIZE_MAX;
+        const size_t k = *p++;
+        if (0 == k || (size_t)(end - p) < (k+1)/2) return SIZE_MAX;
+        if (bufsize - o < k) return bufsize + 1;
+        unpackHex(p, k, q+o, type == TOKEN_HEX_UPPER);
+        o += k;
+        p += (k+1)/2;
+        continue;
+      }
+      case TOKEN_UUID:
+      case TOKEN_UUID_UPPER: {
+        if (end - p < 16) return SIZE_MAX;
+        const bool upper = type == TOKEN_UUID_UPPER;
+        unpackHex(p, 8, s, upper);
+        unpackHex(p+4, 4, s+9, upper);
+        unpackHex(p+6, 4, s+14, upper);
+        unpackHex(p+8, 4, s+19, upper);
+        unpackHex(p+10, 12, s+24, upper);
+        s[8] = s[13] = s[18] = s[23] = '-';
+        n = UUID_SIZE;
+        p += 16;
+        break;
+      }
+      case TOKEN_TIMESTAMP: {
+        if (p == end) return SIZE_MAX;
+        const U8 flags = *p++;
+        if (flags > 15 || !getVarint(p, end, v)) return SIZE_MAX;
+        if ((flags & 3) && !getVarint(p, end, frac)) return SIZE_MAX;
+        const U32 sec = v % 61, min = v / 61 % 60, hour = v / (61*60) % 24,
+                  day = v / (61*60*24) % 31 + 1, month = v / (61*60*24*31) % 12 + 1;
+        const unsigned long long year = v / (61*60*24*31*12);
+        const int f = (flags & 3) * 3;
+        if (year > 9999 || frac >= (f == 9 ? 1000000000u : f == 6 ? 1000000u : 1000u)) return SIZE_MAX;
+        n = sprintf((char*)s, "%04llu-%02u-%02u%c%02u:%02u:%02u", year, month, day,
+                    flags & 8 ? ' ' : 'T', hour, min, sec);
+        if (f) n += sprintf((char*)s+n, ".%0*llu", f, frac);
+        if (flags & 4) s[n++] = 'Z';
+        break;
+      }
+      default:
+        return SIZE_MAX;
+      }
+      if (!put(q, o, bufsize, s, n)) return bufsize + 1;
+    }
+    return o;
+}
+
+// A token buffer: on the stack for short values, on the heap for long ones.
+class TokenBuf {
+  U8 small[512];
+  U8 *p;
+public:
+  explicit TokenBuf(size_t n): p(n <= sizeof(small) ? small : (U8*)malloc(n)) {}
+  ~TokenBuf() { if (p != small) free(p); }
+  U8 *get() { return p; }
+};
+
+extern "C"
+size_t
+fpaq0f2_token_compress(const fpaq0f2_model * const model, const void * const in, const size_t len,
+                       void * const out, const size_t bufsize, const int kinds)
+{
+    PROBE(COMPRESS, FPAQ0F2_CODEC_TOKEN, model ? model->id : 0, len, bufsize);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+    if (kinds & ~FPAQ0F2_TOKEN_ALL) return probe.done(SIZE_MAX);
+    if (len > SIZE_MAX / 2) return probe.done(SIZE_MAX);
+
+    // No token is more than twice as long as its text, as for 0xff.
+    TokenBuf t(2*len);
+    if (NULL == t.get()) return probe.done(SIZE_MAX);
+    const size_t n = fpaq0f2_tokenize(in, len, t.get(), 2*len, kinds);
+    return probe.done(model ? fpaq0f2_model_compress(model, t.get(), n, out, bufsize)
+                            : fpaq0f2_compress(t.get(), n, out, bufsize));
+}
+
+extern "C"
+size_t
+fpaq0f2_token_decompress(const fpaq0f2_model * const model, const void * const in, const size_t len,
+                         void * const out, const size_t bufsize)
+{
+    PROBE(DECOMPRESS, FPAQ0F2_CODEC_TOKEN, model ? model->id : 0, len, bufsize);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+    if (bufsize >= SIZE_MAX / 2) return probe.done(SIZE_MAX);
+
+    // A value that fits has at most 2 token bytes per byte, as for 0xff, but bufsize
+    // may be far larger than the value. Start from a few times the input, and decode
+    // again into twice the room while the tokens do not fit.
+    const size_t most = 2*bufsize + 2;
+    size_t cap = len < most/4 ? 4*len : most;
+    if (cap < 512) cap = most < 512 ? most : 512;
+    for (;;) {
+      TokenBuf t(cap);
+      if (NULL == t.get()) return probe.done(SIZE_MAX);
+      const size_t n = model ? fpaq0f2_model_decompress(model, in, len, t.get(), cap)
+                             : fpaq0f2_decompress(in, len, t.get(), cap);
+      if (SIZE_MAX == n) return probe.done(SIZE_MAX);
+      if (n <= cap) return probe.done(fpaq0f2_detokenize(t.get(), n, out, bufsize));
+      if (cap == most) return probe.done(bufsize + 1);
+      cap = cap < most/2 ? 2*cap : most;
+    }
+}
+
+//////////////////////////// fixed width ////////////////////////////
+
+/* A fixed width value has a length known to both sides, so its bytes are
+   coded as 8 bits each, with neither the not-EOF flag nor the EOF code.
+   The predictors skip context 0 of the flag, so a frozen model trained on
+   flagged values codes fixed width ones as well.
+*/
+
+template <class P>
+static inline bool
+encodeFixed(Encoder<P>& e, const U8 * const in, const size_t len)
+{
+    STAT(symbols_in, len);
+    for (size_t idx = 0; idx < len; ++idx)
+      for (int i=7; i>=0; --i)
+        if (!e.encode((in[idx]>>i)&1)) return false;
+    return e.flush();
+}
+
+// Decode len bytes, return false if the archive ends before them.
+template <class P>
+static inline bool
+decodeFixed(Encoder<P>& e, U8 * const out, const size_t len)
+{
+    for (size_t idx = 0; idx < len; ++idx) {
+      int c=1;
+      while (c<256)
+        c+=c+e.decode();
+      out[idx] = c - 256;
+    }
+    STAT(symbols_out, len);
+    return !e.overrun();
+}
+
+extern "C"
+size_t
+fpaq0f2_compress_fixed(const void * const in, const size_t len, void * const out, const size_t bufsize)
+{
+    PROBE(COMPRESS, FPAQ0F2_CODEC_FIXED, 0, len, bufsize);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+
+    const fpaq0f2_iovec o = {out, bufsize};
+    Encoder<Predictor> e(COMPRESS, &o, 1, 8, true);
+    if (!e.ok()) return probe.done(SIZE_MAX);
+    return probe.done(encodeFixed(e, (const U8*)in, len) ? e.getBufIdx() : bufsize + 1);
+}
+
+extern "C"
+size_t
+fpaq0f2_decompress_fixed(const void * const in, const size_t len, void * const out, const size_t n)
+{
+    PROBE(DECOMPRESS, FPAQ0F2_CODEC_FIXED, 0, len, n);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < n) return probe.done(SIZE_MAX);
+
+    const fpaq0f2_iovec i = {(void*)in, len};
+    Encoder<Predictor> e(DECOMPRESS, &i, 1, 8, true);
+    if (!e.ok()) return probe.done(SIZE_MAX);
+    return probe.done(decodeFixed(e, (U8*)out, n) ? n : SIZE_MAX);
+}
+
+extern "C"
+size_t
+fpaq0f2_model_compress_fixed(const fpaq0f2_model * const model, const void * const in, const size_t len,
+                             void * const out, const size_t bufsize)
+{
+    PROBE(COMPRESS, FPAQ0F2_CODEC_MODEL_FIXED, fpaq0f2_model_id(model), len, bufsize);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+
+    const fpaq0f2_iovec o = {out, bufsize};
+    Encoder<FrozenPredictor> e(COMPRESS, &o, 1, model ? model : default_model(), true);
+    return probe.done(encodeFixed(e, (const U8*)in, len) ? e.getBufIdx() : bufsize + 1);
+}
+
+extern "C"
+size_t
+fpaq0f2_model_decompress_fixed(const fpaq0f2_model * const model, const void * const in, const size_t len,
+                               void * const out, const size_t n)
+{
+    PROBE(DECOMPRESS, FPAQ0F2_CODEC_MODEL_FIXED, fpaq0f2_model_id(model), len, n);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < n) return probe.done(SIZE_MAX);
+
+    const fpaq0f2_iovec i = {(void*)in, len};
+    Encoder<FrozenPredictor> e(DECOMPRESS, &i, 1, model ? model : default_model(), true);
+    return probe.done(decodeFixed(e, (U8*)out, n) ? n : SIZE_MAX);
+}
+
+// One Encoder codes the whole batch, restarting between values.
+extern "C"
+size_t
+fpaq0f2_model_compress_batch(const fpaq0f2_model * const model, const void * const in, const size_t width,
+                             const size_t count, void * const out, const size_t bufsize,
+                             size_t * const offsets)
+{
+    PROBE(COMPRESS, FPAQ0F2_CODEC_BATCH, fpaq0f2_model_id(model), width*count, bufsize);
+    if (NULL == in && 0 < width && 0 < count) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+    if (NULL == offsets) return probe.done(SIZE_MAX);
+    if (0 < width && count > SIZE_MAX / width) return probe.done(SIZE_MAX);
+
+    const fpaq0f2_iovec o = {out, bufsize};
+    Encoder<FrozenPredictor> e(COMPRESS, &o, 1, model ? model : default_model(), true);
+    offsets[0] = 0;
+    for (size_t k = 0; k < count; ++k) {
+      if (k) e.restart();
+      if (!encodeFixed(e, (const U8*)in + k*width, width)) return probe.done(bufsize + 1);
+      offsets[k+1] = e.getBufIdx();
+    }
+    return probe.done(offsets[count]);
+}
+
+extern "C"
+size_t
+fpaq0f2_model_decompress_batch(const fpaq0f2_model * const model, const void * const in, const size_t len,
+                               const size_t * const offsets, const size_t count, const size_t width,
+                               void * const out)
+{
+    PROBE(DECOMPRESS, FPAQ0F2_CODEC_BATCH, fpaq0f2_model_id(model), len, count*width);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == offsets) return probe.done(SIZE_MAX);
+    if (0 < width && count > SIZE_MAX / width) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < width && 0 < count) return probe.done(SIZE_MAX);
+    if (0 == count) return probe.done(0);
+
+    const fpaq0f2_iovec v = {NULL, 0};
+    Encoder<FrozenPredictor> e(DECOMPRESS, &v, 1, model ? model : default_model(), true);
+    for (size_t k = 0; k < count; ++k) {
+      if (offsets[k] > offsets[k+1] || offsets[k+1] > len) return probe.done(SIZE_MAX);
+      e.setBuf((const U8*)in + offsets[k], offsets[k+1] - offsets[k]);
+      e.restart();
+      if (!decodeFixed(e, (U8*)out + k*width, width)) return probe.done(SIZE_MAX);
+    }
+    return probe.done(count * width);
+}
+
+//////////////////////////// frame ////////////////////////////
+
+/* A frame wraps a compressed value with a header, in this order:
+     magic           1 byte, 0xf2
+     flags           1 byte, FPAQ0F2_FRAME_* bits in bits 0..1, their
+                     complement in bits 2..3, so that no single bit
+                     error can drop the CRC, and 0 in bits 4..7
+     length          uncompressed length, LEB128 varint of 1..10 bytes
+     model id        4 bytes little endian, if FPAQ0F2_FRAME_MODEL
+     CRC32C          4 bytes little endian, if FPAQ0F2_FRAME_CRC, of all
+                     the bytes before it and all the bytes after it
+     payload         the compressed bytes, up to the end of the frame
+*/
+
+static const U8 FRAME_MAGIC = 0xf2;
+static const U32 FRAME_FLAGS = FPAQ0F2_FRAME_MODEL | FPAQ0F2_FRAME_CRC;
+
+static inline U8
+frameFlags(const U32 flags)
+{
+    return flags | (~flags & FRAME_FLAGS) << 2;
+}
+
+static inline void
+put32(U8 * const p, const U32 v)
+{
+    p[0]=v, p[1]=v>>8, p[2]=v>>16, p[3]=v>>24;
+}
+
+static inline U32
+get32(const U8 * const p)
+{
+    return p[0] | p[1]<<8 | p[2]<<16 | (U32)p[3]<<24;
+}
+
+extern "C"
+int
+fpaq0f2_frame_parse(const void * const in, const size_t len, fpaq0f2_frame_info * const info)
+{
+    if (NULL == info || (NULL == in && 0 < len)) return -1;
+
+    const U8 * const p = (const U8*)in;
+    if (len < 3 || FRAME_MAGIC != p[0] || frameFlags(p[1] & FRAME_FLAGS) != p[1]) return -1;
+    const int flags = p[1] & FRAME_FLAGS;
+
+    size_t idx = 2, length = 0;
+    for (int shift = 0; ; shift += 7) {
+      if (idx == len || shift > 63) return -1;
+      const U8 b = p[idx++];
+      length |= (size_t)(b & 0x7f) << shift;
+      if (!(b & 0x80)) break;
+    }
+
+    info->flags = flags;
+    info->length = length;
+    info->model_id = 0;
+    if (flags & FPAQ0F2_FRAME_MODEL) {
+      if (len - idx < 4) return -1;
+      info->model_id = get32(p + idx);
+      idx += 4;
+    }
+    if (flags & FPAQ0F2_FRAME_CRC) {
+      if (len - idx < 4) return -1;
+      idx += 4;
+    }
+    if (idx == len) return -1;  // a value has at least 1 compressed byte
+    info->header_size = idx;
+    return 0;
+}
+
+// Decode the first m of length bytes, and if that is all of them, the EOF
+// code after them. Return false if the payload does not hold them.
+template <class P>
+static bool
+decodeFrame(Encoder<P>& e, U8 * const out, const size_t m, const size_t length)
+{
+    for (size_t idx = 0; idx < m; ++idx) {
+      const int c = decodeByte(e);
+      if (c < 0 || e.overrun()) return false;
+      out[idx] = c;
+    }
+    return m < length || (decodeByte(e) < 0 && !e.overrun());
+}
+
+extern "C"
+size_t
+fpaq0f2_frame_compress(const fpaq0f2_model * const model, const void * const in, const size_t len,
+                       void * const out, const size_t bufsize, const int flags)
+{
+    PROBE(COMPRESS, FPAQ0F2_CODEC_FRAME, model ? model->id : 0, len, bufsize);
+    if (NULL == in && 0 < len) return probe.done(SIZE_MAX);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+    if (flags & ~FPAQ0F2_FRAME_CRC) return probe.done(SIZE_MAX);
+
+    U8 hdr[2+10+4+4];
+    size_t h = 0;
+    hdr[h++] = FRAME_MAGIC;
+    hdr[h++] = frameFlags(flags | (model ? FPAQ0F2_FRAME_MODEL : 0));
+    for (size_t v = len; ; v >>= 7) {
+      hdr[h++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+      if (v <= 0x7f) break;
+    }
+    if (model) put32(hdr + h, model->id), h += 4;
+    const size_t crcIdx = h;
+    if (flags & FPAQ0F2_FRAME_CRC) h += 4;
+    if (bufsize < h) return probe.done(bufsize + 1);
+
+    const size_t n = model ? fpaq0f2_model_compress(model, in, len, (U8*)out + h, bufsize - h)
+                           : fpaq0f2_compress(in, len, (U8*)out + h, bufsize - h);
+    if (n > bufsize - h) return probe.done(bufsize + 1);
+
+    if (flags & FPAQ0F2_FRAME_CRC) {
+      const U32 crc = fpaq0f2_crc32c(fpaq0f2_crc32c(0, hdr, crcIdx), (U8*)out + h, n);
+      put32(hdr + crcIdx, crc);
+    }
+    memcpy(out, hdr, h);
+    return probe.done(h + n);
+}
+
+extern "C"
+size_t
+fpaq0f2_frame_decompress(const fpaq0f2_model * const model, const void * const in, const size_t len,
+                         void * const out, const size_t bufsize)
+{
+    PROBE(DECOMPRESS, FPAQ0F2_CODEC_FRAME, model ? model->id : 0, len, bufsize);
+    if (NULL == out && 0 < bufsize) return probe.done(SIZE_MAX);
+
+    fpaq0f2_frame_info info;
+    if (fpaq0f2_frame_parse(in, len, &info)) return probe.done(SIZE_MAX);
+
+    // Check everything cheap before decoding anything.
+    const U8 * const p = (const U8*)in;
+    const U8 * const payload = p + info.header_size;
+    const size_t n = len - info.header_size;
+    if (!(info.flags & FPAQ0F2_FRAME_MODEL) != !model) return probe.done(SIZE_MAX);
+    if (model && info.model_id != model->id) return probe.done(SIZE_MAX);
+    if (info.flags & FPAQ0F2_FRAME_CRC) {
+      const size_t crcIdx = info.header_size - 4;
+      const U32 crc = fpaq0f2_crc32c(fpaq0f2_crc32c(0, p, crcIdx), payload, n);
+      if (crc != get32(p + crcIdx)) return probe.done(SIZE_MAX);
+    }
+    const fpaq0f2_iovec v = {(void*)payload, n};
+    const size_t m = info.length < bufsize ? info.length : bufsize;
+    bool ok;
+    if (model) {
+      Encoder<FrozenPredictor> e(DECOMPRESS, &v, 1, model);
+      ok = decodeFrame(e, (U8*)out, m, info.length);
+    } else {
+      Encoder<Predictor> e(DECOMPRESS, &v, 1);
+      ok = e.ok() && decodeFrame(e, (U8*)out, m, info.length);
+    }
+    if (!ok) return probe.done(SIZE_MAX);
+    return probe.done(m < info.length ? bufsize + 1 : m);
+}
+
+//////////////////////////// iterator ////////////////////////////
+
+// The decoder state behind an fpaq0f2_iter.
+struct Iterator {
+  Encoder<FrozenPredictor> e;
+  bool done;  // EOF was decoded
+  Iterator(const fpaq0f2_iovec& v, const fpaq0f2_model* model): e(DECOMPRESS, &v, 1, model), done(false) {}
+};
+
+static_assert(sizeof(Iterator) <= sizeof(((fpaq0f2_iter*)0)->opaque), "fpaq0f2_iter is too small");
+static_assert(alignof(Iterator) <= alignof(fpaq0f2_iter), "fpaq0f2_iter is misaligned");
+
+extern "C"
+int
+fpaq0f2_iter_init(fpaq0f2_iter * const it, const fpaq0f2_model * const model, const void * const in, const size_t len)
+{
+    if (NULL == it) return -1;
+    if (NULL == in && 0 < len) return -1;
+
+    const fpaq0f2_iovec v = {(void*)in, len};
+    new (it->opaque.bytes) Iterator(v, model ? model : default_model());
+    return 0;
+}
+
+extern "C"
+int
+fpaq0f2_iter_next(fpaq0f2_iter * const it)
+{
+    Iterator& i = *(Iterator*)it->opaque.bytes;
+    if (i.done) return -1;
+    const int c = decodeByte(i.e);
+    if (c < 0 || i.e.overrun()) {
+      i.done = true;
+      return -1;
+    }
+    return c;
+}
+
+//////////////////////////// stream ////////////////////////////
+
+/* A Stream codes one value in chunks.  It keeps the Encoder and its model
+   between calls, and stages the compressed bytes in a small buffer.  A
+   compressing stream encodes a byte only while the stage has room for the
+   longest code of a symbol, and a decompressing stream decodes a byte only
+   while the stage holds enough compressed bytes for one, so every call can
+   stop between two symbols when the input runs dry or the output is full,
+   and the next call resumes from there.
+*/
+
+// Most bytes a 9 bit symbol can shift through the coder, up to 4 per bit.
+static const U32 SYMBOL_BYTES = 9*4;
+
+struct fpaq0f2_stream {
+  virtual ~fpaq0f2_stream() {}
+  virtual void reset() = 0;
+  virtual int update(const U8* in, size_t len, size_t* in_used,
+                     U8* out, size_t bufsize, size_t* out_used) = 0;
+  virtual int finish(U8* out, size_t bufsize, size_t* out_used) = 0;
+};
+
+template <class P>
+class Stream: public fpaq0f2_stream {
+  const Mode mode;
+  const fpaq0f2_model *const model;
+  Encoder<P> *e;         // Decompressing: NULL until the first 4 bytes arrive
+  bool done;             // All of the value is coded
+  bool failed;           // Out of memory, or decompressing: the input is not a whole value
+  U32 head, fill;        // Compressing: stage[head, fill) is not yet written out
+  U8 stage[4096];        // Decompressing: stage[e->getBufIdx(), fill) is not yet read
+  alignas(Encoder<P>) unsigned char storage[sizeof(Encoder<P>)];
+
+  void start();
+  size_t drain(U8* out, size_t bufsize);
+  void decode(U8* out, size_t bufsize, size_t& o, bool last);
+public:
+  Stream(Mode m, const fpaq0f2_model* mdl): mode(m), model(mdl), e(NULL) { reset(); }
+  ~Stream() { if (e) e->~Encoder<P>(); }
+  bool ok() const { return !failed; }
+  void reset();
+  int update(const U8* in, size_t len, size_t* in_used, U8* out, size_t bufsize, size_t* out_used);
+  int finish(U8* out, size_t bufsize, size_t* out_used);
+};
+
+static Encoder<Predictor> *
+construct(Encoder<Predictor> * const p, const Mode m, const fpaq0f2_iovec& v, const fpaq0f2_model*)
+{
+    return new (p) Encoder<Predictor>(m, &v, 1);
+}
+
+static Encoder<FrozenPredictor> *
+construct(Encoder<FrozenPredictor> * const p, const Mode m, const fpaq0f2_iovec& v,
+          const fpaq0f2_model* model)
+{
+    return new (p) Encoder<FrozenPredictor>(m, &v, 1, model);
+}
+
+template <class P>
+void Stream<P>::reset() {
+  if (e) e->~Encoder<P>();
+  e=NULL;
+  done=failed=false;
+  head=fill=0;
+  if (mode==COMPRESS) start();
+}
+
+template <class P>
+void Stream<P>::start() {
+  const fpaq0f2_iovec v = {stage, mode==COMPRESS ? sizeof(stage) : fill};
+  e=construct((Encoder<P>*)storage, mode, v, model);
+  if (!e->ok()) {
+    e->~Encoder<P>();
+    e=NULL;
+    failed=true;
+  }
+}
+
+// Write out staged compressed bytes, return how many.
+template <class P>
+size_t Stream<P>::drain(U8* const out, const size_t bufsize) {
+  const size_t n = fill-head < bufsize ? fill-head : bufsize;
+  if (n) memcpy(out, stage+head, n);
+  head+=n;
+  return n;
+}
+
+// Decode symbols from the stage into out[o, bufsize). Unless this is the
+// last of the input, stop while a symbol may still need unstaged bytes.
+template <class P>
+void Stream<P>::decode(U8* const out, const size_t bufsize, size_t& o, const bool last) {
+  if (!e) {
+    if (!last && fill < 4+SYMBOL_BYTES) return;
+    start();
+    if (!e) return;
+  }
+  while (!done && o < bufsize && (last || fill-e->getBufIdx() >= SYMBOL_BYTES)) {
+    const int c = decodeByte(*e);
+    if (e->overrun()) {
+      failed=true;
+      break;
+    }
+    if (c<0) {
+      done=true;
+      break;
+    }
+    out[o++] = c;
+  }
+}
+
+template <class P>
+int Stream<P>::update(const U8* const in, const size_t len, size_t* const in_used,
+                      U8* const out, const size_t bufsize, size_t* const out_used) {
+  size_t i=0, o=0;
+  int status=FPAQ0F2_STREAM_OK;
+
+  if (mode==COMPRESS) {
+    if (done || failed) return FPAQ0F2_STREAM_ERROR;
+    for (;;) {
+      o+=drain(out+o, bufsize-o);
+      if (head<fill) {
+        status=FPAQ0F2_STREAM_FULL;
+        break;
+      }
+      if (i==len) break;
+
+      // The stage is empty, encode into it while a whole symbol fits.
+      e->setBuf(stage, sizeof(stage));
+      head=0;
+      while (i<len && sizeof(stage)-e->getBufIdx() >= SYMBOL_BYTES)
+        encodeByte(*e, in[i++]);
+      fill=e->getBufIdx();
+    }
+  } else {
+    for (;;) {
+      decode(out, bufsize, o, false);
+      if (done || failed || o==bufsize || i==len) break;
+
+      // Move the unread bytes to the front of the stage and top it up.
+      const U32 r = e ? e->getBufIdx() : 0;
+      memmove(stage, stage+r, fill-r);
+      fill-=r;
+      const size_t n = len-i < sizeof(stage)-fill ? len-i : sizeof(stage)-fill;
+      memcpy(stage+fill, in+i, n);
+      fill+=n;
+      i+=n;
+      if (e) e->setBuf((const U8*)stage, fill);
+    }
+    if (failed) status=FPAQ0F2_STREAM_ERROR;
+    else if (done) status=FPAQ0F2_STREAM_END;
+    else if (o==bufsize) status=FPAQ0F2_STREAM_FULL;
+  }
+
+  *in_used=i;
+  *out_used=o;
+  return status;
+}
+
+template <class P>
+int Stream<P>::finish(U8* const out, const size_t bufsize, size_t* const out_used) {
+  size_t o=0;
+
+  if (mode==COMPRESS) {
+    if (failed) {
+      *out_used=0;
+      return FPAQ0F2_STREAM_ERROR;
+    }
+    o+=drain(out, bufsize);
+    if (!done && head==fill) {
+      e->setBuf(stage, sizeof(stage));
+      head=0;
+      e->encode(0);  // EOF code
+      e->flush();
+      fill=e->getBufIdx();
+      done=true;
+      o+=drain(out+o, bufsize-o);
+    }
+    *out_used=o;
+    return done && head==fill ? FPAQ0F2_STREAM_END : FPAQ0F2_STREAM_FULL;
+  }
+
+  decode(out, bufsize, o, true);
+  *out_used=o;
+  if (failed) return FPAQ0F2_STREAM_ERROR;
+  return done ? FPAQ0F2_STREAM_END : FPAQ0F2_STREAM_FULL;
+}
+
+extern "C"
+fpaq0f2_stream *
+fpaq0f2_stream_new(const int decompress)
+{
+    Stream<Predictor> * const s = new (std::nothrow) Stream<Predictor>(decompress ? DECOMPRESS : COMPRESS, NULL);
+    if (s && !s->ok()) {
+      delete s;
+      return NULL;
+    }
+    return s;
+}
+
+extern "C"
+fpaq0f2_stream *
+fpaq0f2_model_stream_new(const fpaq0f2_model * const model, const int decompress)
+{
+    return new (std::nothrow) Stream<FrozenPredictor>(decompress ? DECOMPRESS : COMPRESS,
+                                                      model ? model : default_model());
+}
+
+extern "C"
+void
+fpaq0f2_stream_free(fpaq0f2_stream * const s)
+{
+    delete s;
+}
+
+extern "C"
+void
+fpaq0f2_stream_reset(fpaq0f2_stream * const s)
+{
+    if (NULL == s) return;
+    s->reset();
+}
+
+extern "C"
+int
+fpaq0f2_stream_update(fpaq0f2_stream * const s, const void * const in, const size_t len, size_t * const in_used,
+                      void * const out, const size_t bufsize, size_t * const out_used)
+{
+    if (NULL == s || NULL == in_used || NULL == out_used) return FPAQ0F2_STREAM_ERROR;
+    if (NULL == in && 0 < len) return FPAQ0F2_STREAM_ERROR;
+    if (NULL == out && 0 < bufsize) return FPAQ0F2_STREAM_ERROR;
+
+    return s->update((const U8*)in, len, in_used, (U8*)out, bufsize, out_used);
+}
+
+extern "C"
+int
+fpaq0f2_stream_finish(fpaq0f2_stream * const s, void * const out, const size_t bufsize, size_t * const out_used)
+{
+    if (NULL == s || NULL == out_used) return FPAQ0F2_STREAM_ERROR;
+    if (NULL == out && 0 < bufsize) return FPAQ0F2_STREAM_ERROR;
+
+    return s->finish((U8*)out, bufsize, out_used);
+}
+
+//////////////////////////// queue ////////////////////////////
+
+/* A Ring is a bounded lock-free queue of jobs in the manner of Dmitry
+   Vyukov's: each cell carries a sequence number telling whether it is
+   free for the push of a given round or full for its pop, so pushes and
+   pops claim a cell with one compare and swap and never wait for one
+   another. The submission ring is pushed by any thread and popped by all
+   workers, the completion ring pushed by all workers and popped by the
+   polling thread.
+*/
+
+class Ring {
+  struct Cell {
+    std::atomic<size_t> seq;
+    fpaq0f2_job *job;
+  };
+  Cell *const cells;
+  const size_t mask;
+  alignas(64) std::atomic<size_t> head;  // next push
+  alignas(64) std::atomic<size_t> tail;  // next pop
+public:
+  explicit Ring(size_t size): cells(new Cell[size]), mask(size-1), head(0), tail(0) {
+    for (size_t i=0; i<size; ++i)
+      cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+  ~Ring() { delete[] cells; }
+
+  // Return false if full.
+  bool push(fpaq0f2_job *job) {
+    size_t pos=head.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell& c=cells[pos&mask];
+      const intptr_t d=(intptr_t)(c.seq.load(std::memory_order_acquire)-pos);
+      if (d==0) {
+        if (head.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
+          c.job=job;
+          c.seq.store(pos+1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (d<0)
+        return false;
+      else
+        pos=head.load(std::memory_order_relaxed);
+    }
+  }
+
+  // Return NULL if empty.
+  fpaq0f2_job *pop() {
+    size_t pos=tail.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell& c=cells[pos&mask];
+      const intptr_t d=(intptr_t)(c.seq.load(std::memory_order_acquire)-(pos+1));
+      if (d==0) {
+        if (tail.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
+          fpaq0f2_job *const job=c.job;
+          c.seq.store(pos+mask+1, std::memory_order_release);
+          return job;
+        }
+      }
+      else if (d<0)
+        return NULL;
+      else
+        pos=tail.load(std::memory_order_relaxed);
+    }
+  }
+};
+
+/* Workers spin a little on an empty submission ring, then sleep on a
+   condition variable. A submitter pushes, then wakes one only if the count
+   of sleepers is not 0; a fence on each side makes sure that either the
+   submitter sees the sleeper, or the sleeper sees the job before it waits.
+*/
+struct fpaq0f2_queue {
+  Ring submitted, completed;
+  alignas(64) std::atomic<int> sleepers;
+  std::atomic<bool> stopping;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::thread *workers;
+  unsigned count;
+
+  fpaq0f2_queue(size_t depth): submitted(depth), completed(depth), sleepers(0), stopping(false),
+                               workers(NULL), count(0) {}
+
+  void notify(bool all) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (0 == sleepers.load(std::memory_order_relaxed)) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (all) wake.notify_all();
+    else wake.notify_one();
+  }
+
+  // The next job, or NULL once stopping with none left.
+  fpaq0f2_job *next() {
+    for (int i=0; i<64; ++i) {
+      if (fpaq0f2_job *const job=submitted.pop()) return job;
+      std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    sleepers.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    fpaq0f2_job *job;
+    while (NULL == (job=submitted.pop()) && !stopping.load(std::memory_order_relaxed))
+      wake.wait(lock);
+    sleepers.fetch_sub(1, std::memory_order_relaxed);
+    return job;
+  }
+
+  void work() {
+    fpaq0f2_ctx ctx;
+    while (fpaq0f2_job *const j=next()) {
+      if (FPAQ0F2_JOB_COMPRESS == j->op)
+        j->result = j->model ? fpaq0f2_model_compress(j->model, j->in, j->len, j->out, j->bufsize)
+                             : fpaq0f2_ctx_compress(&ctx, j->in, j->len, j->out, j->bufsize);
+      else if (FPAQ0F2_JOB_DECOMPRESS == j->op)
+        j->result = j->model ? fpaq0f2_model_decompress(j->model, j->in, j->len, j->out, j->bufsize)
+                             : fpaq0f2_ctx_decompress(&ctx, j->in, j->len, j->out, j->bufsize);
+      else
+        j->result = SIZE_MAX;
+      if (j->done)
+        j->done(j);
+      else
+        while (!completed.push(j) && !stopping.load(std::memory_order_relaxed))
+          std::this_thread::yield();
+    }
+  }
+
+  ~fpaq0f2_queue() {
+    stopping.store(true, std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      wake.notify_all();
+    }
+    for (unsigned i=0; i<count; ++i)
+      workers[i].join();
+    delete[] workers;
+  }
+};
+
+extern "C"
+fpaq0f2_queue *
+fpaq0f2_queue_new(unsigned workers, const size_t depth)
+{
+    if (0 == workers) workers = std::thread::hardware_concurrency();
+    if (0 == workers) workers = 1;
+    size_t size = 2;
+    while (size < depth && size <= SIZE_MAX/4) size *= 2;
+    if (size < depth) return NULL;
+
+    fpaq0f2_queue * q = NULL;
+    try {
+        q = new fpaq0f2_queue(size);
+        q->workers = new std::thread[workers];
+        for (; q->count < workers; ++q->count)
+          q->workers[q->count] = std::thread(&fpaq0f2_queue::work, q);
+    } catch (const std::exception&) {
+        delete q;
+        return NULL;
+    }
+    return q;
+}
+
+extern "C"
+void
+fpaq0f2_queue_free(fpaq0f2_queue * const q)
+{
+    delete q;
+}
+
+extern "C"
+int
+fpaq0f2_queue_submit(fpaq0f2_queue * const q, fpaq0f2_job * const job)
+{
+    if (NULL == q || NULL == job) return -1;
+    if (!q->submitted.push(job)) return -1;
+    q->notify(false);
+    return 0;
+}
+
+extern "C"
+size_t
+fpaq0f2_queue_submit_batch(fpaq0f2_queue * const q, fpaq0f2_job * const * const jobs, const size_t n)
+{
+    if (NULL == q || (NULL == jobs && 0 < n)) return 0;
+    size_t k = 0;
+    while (k < n && NULL != jobs[k] && q->submitted.push(jobs[k])) ++k;
+    if (k) q->notify(k > 1);
+    return k;
+}
+
+extern "C"
+size_t
+fpaq0f2_queue_poll(fpaq0f2_queue * const q, fpaq0f2_job ** const jobs, const size_t max)
+{
+    if (NULL == q || NULL == jobs) return 0;
+    size_t k = 0;
+    while (k < max && NULL != (jobs[k] = q->completed.pop())) ++k;
+    return k;
 }
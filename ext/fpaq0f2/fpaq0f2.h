@@ -1,4 +1,5 @@
 #include <stddef.h>
+#include <stdint.h>
 
 #ifndef __FPAQ0F2_H__
 #define __FPAQ0F2_H__
@@ -15,10 +16,423 @@ size_t fpaq0f2_compress(const void * in, size_t len, void * out, size_t bufsize)
 
 /* Decompress [in, in + len) bytes into [out, out + return) bytes if buffer is larger enough,
  * otherwise return bufszie + 1, and first bufsize decompressed bytes will be filled into
- * the out buffer. On error, return SIZE_MAX.
+ * the out buffer. On error, return SIZE_MAX. Input that ends before the compressed value
+ * does, such as a truncated one, is an error as soon as the decoder runs out of it.
  */
 size_t fpaq0f2_decompress(const void * in, size_t len, void * out, size_t bufsize);
 
+/* A segment of a scattered buffer, laid out as struct iovec. */
+typedef struct fpaq0f2_iovec {
+    void * base;
+    size_t len;
+} fpaq0f2_iovec;
+
+/* Same as fpaq0f2_compress() and fpaq0f2_decompress(), but read the input from the
+ * concatenation of incnt segments, and write the output across outcnt segments in
+ * order, with bufsize being their total length. Segments are never copied together.
+ */
+size_t fpaq0f2_compressv(const fpaq0f2_iovec * in, size_t incnt,
+                         const fpaq0f2_iovec * out, size_t outcnt);
+size_t fpaq0f2_decompressv(const fpaq0f2_iovec * in, size_t incnt,
+                           const fpaq0f2_iovec * out, size_t outcnt);
+
+/* A context keeps the adaptive model of fpaq0f2_compress() and fpaq0f2_decompress()
+ * between calls, so that coding many short values does not allocate and initialize a
+ * fresh 256 KB model for each of them. The model is reset in place on every call, so
+ * the output is the same. A context codes one value at a time, use one per thread.
+ * Return NULL if out of memory.
+ */
+typedef struct fpaq0f2_ctx fpaq0f2_ctx;
+
+fpaq0f2_ctx * fpaq0f2_ctx_new(void);
+void fpaq0f2_ctx_free(fpaq0f2_ctx * ctx);
+
+/* Same as fpaq0f2_compress() and fpaq0f2_decompress(), with the model of ctx. */
+size_t fpaq0f2_ctx_compress(fpaq0f2_ctx * ctx, const void * in, size_t len,
+                            void * out, size_t bufsize);
+size_t fpaq0f2_ctx_decompress(fpaq0f2_ctx * ctx, const void * in, size_t len,
+                              void * out, size_t bufsize);
+
+/* Counters of what the coder did in the calling thread, kept only when the library is
+ * built with -DFPAQ0F2_STATS, and compiled out otherwise. They cover every entry point.
+ */
+typedef struct fpaq0f2_stats {
+    uint64_t values;         /* values started: new coders and restarts */
+    uint64_t symbols_in;     /* bytes, or alphabet symbols, compressed */
+    uint64_t symbols_out;    /* bytes, or alphabet symbols, decompressed */
+    uint64_t bits_encoded;   /* binary decisions coded: 9 per byte and 1 per value, or 8 per
+                              * byte in fixed width */
+    uint64_t bits_decoded;
+    uint64_t bytes_out;      /* compressed bytes shifted out by renormalization and flushing */
+    uint64_t bytes_in;       /* compressed bytes shifted in by renormalization */
+    uint64_t pads;           /* zeros shifted in past the end of the compressed bytes */
+    uint64_t model_updates;  /* adaptive model entries updated; frozen models are only read */
+    uint64_t model_allocs;   /* adaptive models allocated, 256 KB each for bytes */
+    uint64_t model_resets;   /* adaptive models reset by an fpaq0f2_ctx */
+    uint64_t entries_reset;  /* adaptive model entries initialized, by allocations and resets */
+    uint64_t overflows;      /* output buffers found too small, each a bufsize + 1 return that
+                              * the caller retries */
+} fpaq0f2_stats;
+
+/* Copy the counters of the calling thread into *s and return 0, or clear *s and return
+ * -1 if the library is built without FPAQ0F2_STATS.
+ */
+int fpaq0f2_stats_get(fpaq0f2_stats * s);
+
+/* Clear the counters of the calling thread. */
+void fpaq0f2_stats_reset(void);
+
+/* Codec ids, carried by the USDT probes that every compress and decompress entry point
+ * fires when the library is built with <sys/sdt.h>: fpaq0f2:compress__start(codec,
+ * model id, len, bufsize) and fpaq0f2:compress__done(codec, model id, len, result), and
+ * the same for decompress. The model id is 0 for adaptive coding.
+ */
+#define FPAQ0F2_CODEC_ADAPTIVE       0  /* fpaq0f2_compress(), v and hash variants */
+#define FPAQ0F2_CODEC_CONTEXT        1  /* fpaq0f2_ctx_compress() */
+#define FPAQ0F2_CODEC_MODEL          2  /* fpaq0f2_model_compress(), v and hash variants */
+#define FPAQ0F2_CODEC_ALPHABET       3  /* fpaq0f2_alphabet_compress() */
+#define FPAQ0F2_CODEC_ALPHABET_BLOCK 4  /* fpaq0f2_alphabet_block_compress() */
+#define FPAQ0F2_CODEC_TOKEN          5  /* fpaq0f2_token_compress() */
+#define FPAQ0F2_CODEC_FIXED          6  /* fpaq0f2_compress_fixed() */
+#define FPAQ0F2_CODEC_MODEL_FIXED    7  /* fpaq0f2_model_compress_fixed() */
+#define FPAQ0F2_CODEC_BATCH          8  /* fpaq0f2_model_compress_batch() */
+#define FPAQ0F2_CODEC_FRAME          9  /* fpaq0f2_frame_compress() */
+
+/* Process-wide metrics, kept only when the library is built with -DFPAQ0F2_METRICS: per
+ * operation and codec, the calls, errors, overflows, bytes in and out and a latency
+ * histogram, summed over all threads. A call made by another entry point, such as
+ * fpaq0f2_compress() by fpaq0f2_token_compress(), is counted only in the outer one.
+ *
+ * fpaq0f2_metrics_render() writes them in the Prometheus text exposition format into
+ * [out, out + return), or returns bufsize + 1 if the buffer is too small. The output is
+ * not NUL terminated. It returns SIZE_MAX if the library is built without metrics.
+ */
+size_t fpaq0f2_metrics_render(void * out, size_t bufsize);
+
+/* Write the metrics to path, through a temporary file renamed over it, so that readers
+ * such as the node_exporter textfile collector never see a partial file. Return 0, or
+ * -1 on error or if the library is built without metrics.
+ */
+int fpaq0f2_metrics_write(const char * path);
+
+/* Start a thread that writes the metrics to path every interval seconds, replacing the
+ * one started before, if any, until fpaq0f2_metrics_stop() or exit. Return 0, or -1 on
+ * error or if the library is built without metrics.
+ */
+int fpaq0f2_metrics_start(const char * path, unsigned interval);
+void fpaq0f2_metrics_stop(void);
+
+/* A frozen model is a trained snapshot of the predictions, which is only read while
+ * coding. It can be shared by any number of threads, and the same input always
+ * compresses to the same bytes, so compressed values can be compared for equality.
+ * Within one model, compressed values also sort in the reverse order of their
+ * uncompressed bytes, when compared by memcmp() and then by length.
+ */
+typedef struct fpaq0f2_model fpaq0f2_model;
+
+/* Return the untrained built-in model. It is never NULL and must not be freed. */
+const fpaq0f2_model * fpaq0f2_model_default(void);
+
+/* Train a model over n samples stored back to back in the samples buffer, the k-th
+ * sample being lens[k] bytes long. Free the result by fpaq0f2_model_free().
+ * On error, return NULL.
+ */
+fpaq0f2_model * fpaq0f2_model_train(const void * samples, const size_t * lens, size_t n);
+
+void fpaq0f2_model_free(fpaq0f2_model * model);
+
+/* Return the CRC32C of the model's predictions as saved, which names it in frames. */
+uint32_t fpaq0f2_model_id(const fpaq0f2_model * model);
+
+/* Save a model (NULL means fpaq0f2_model_default()) in a portable FPAQ0F2_MODEL_SIZE byte
+ * form. Return FPAQ0F2_MODEL_SIZE, or bufsize + 1 if it does not fit.
+ */
+#define FPAQ0F2_MODEL_SIZE (4 + 2 * 65536 + 4)
+size_t fpaq0f2_model_save(const fpaq0f2_model * model, void * out, size_t bufsize);
+
+/* Load a saved model, checking its id. Free it by fpaq0f2_model_free(). On error, such as
+ * a corrupt model, return NULL.
+ */
+fpaq0f2_model * fpaq0f2_model_load(const void * in, size_t len);
+
+/* Load a model saved whole in the file at path, as fpaq0f2_model_load() does. Return
+ * NULL if the file cannot be read, or does not hold exactly one model.
+ */
+fpaq0f2_model * fpaq0f2_model_load_file(const char * path);
+
+/* Same as fpaq0f2_compress() and fpaq0f2_decompress(), but code with a frozen model,
+ * which needs no allocation. A NULL model means fpaq0f2_model_default(). The output
+ * is only readable with the same model.
+ */
+size_t fpaq0f2_model_compress(const fpaq0f2_model * model, const void * in, size_t len,
+                              void * out, size_t bufsize);
+size_t fpaq0f2_model_decompress(const fpaq0f2_model * model, const void * in, size_t len,
+                                void * out, size_t bufsize);
+size_t fpaq0f2_model_compressv(const fpaq0f2_model * model,
+                               const fpaq0f2_iovec * in, size_t incnt,
+                               const fpaq0f2_iovec * out, size_t outcnt);
+size_t fpaq0f2_model_decompressv(const fpaq0f2_model * model,
+                                 const fpaq0f2_iovec * in, size_t incnt,
+                                 const fpaq0f2_iovec * out, size_t outcnt);
+
+/* Return the hash of [in, in + len) that the fused functions below compute. It is
+ * CRC32C, unless the library is built with -DFPAQ0F2_HASH=Fnv1a (32 bit FNV-1a) or
+ * another hash class.
+ */
+uint32_t fpaq0f2_hash(const void * in, size_t len);
+
+/* Update a CRC32C (Castagnoli) with [in, in + len), starting from crc 0. It uses the
+ * CPU's CRC32 instruction where available.
+ */
+uint32_t fpaq0f2_crc32c(uint32_t crc, const void * in, size_t len);
+
+/* Same as fpaq0f2_compress(), fpaq0f2_decompress() and their frozen-model variants, but
+ * also store fpaq0f2_hash() of the uncompressed bytes into *hash, computed in the same
+ * pass over them.
+ */
+size_t fpaq0f2_compress_hash(const void * in, size_t len, void * out, size_t bufsize,
+                             uint32_t * hash);
+size_t fpaq0f2_decompress_hash(const void * in, size_t len, void * out, size_t bufsize,
+                               uint32_t * hash);
+size_t fpaq0f2_model_compress_hash(const fpaq0f2_model * model, const void * in, size_t len,
+                                   void * out, size_t bufsize, uint32_t * hash);
+size_t fpaq0f2_model_decompress_hash(const fpaq0f2_model * model, const void * in, size_t len,
+                                     void * out, size_t bufsize, uint32_t * hash);
+
+/* An alphabet maps the bytes of a restricted character set, such as hex digits or
+ * base64, to symbol codes of ceil(log2(size)) bits, so that each byte is coded with that
+ * many binary decisions plus 1 instead of 9, and the adaptive model is smaller by the
+ * same factor. It is plain data, and may be stored next to the values it codes.
+ */
+typedef struct fpaq0f2_alphabet {
+    uint16_t size;          /* number of symbols, 1..256 */
+    uint8_t bits;           /* bits per symbol code, ceil(log2(size)) */
+    int16_t code[256];      /* byte -> symbol code, or -1 if not in the alphabet */
+    uint8_t byte[256];      /* symbol code -> byte, for codes below size */
+} fpaq0f2_alphabet;
+
+/* Build the alphabet of the bytes in [samples, samples + len), with symbol codes in
+ * byte order. Return 0, or -1 if there are no samples.
+ */
+int fpaq0f2_alphabet_train(fpaq0f2_alphabet * a, const void * samples, size_t len);
+
+/* Same as fpaq0f2_compress() and fpaq0f2_decompress(), but code symbols of the alphabet.
+ * Compressing a byte outside of the alphabet is an error. The output is only readable
+ * with the same alphabet.
+ */
+size_t fpaq0f2_alphabet_compress(const fpaq0f2_alphabet * a, const void * in, size_t len,
+                                 void * out, size_t bufsize);
+size_t fpaq0f2_alphabet_decompress(const fpaq0f2_alphabet * a, const void * in, size_t len,
+                                   void * out, size_t bufsize);
+
+/* Same as above, but with the alphabet of the block's own bytes, stored in front of
+ * the compressed bytes in 2..33 bytes.
+ */
+size_t fpaq0f2_alphabet_block_compress(const void * in, size_t len, void * out, size_t bufsize);
+size_t fpaq0f2_alphabet_block_decompress(const void * in, size_t len, void * out, size_t bufsize);
+
+/* Fixed width mode codes values whose length both sides know, as for CHAR(n) columns, with
+ * 8 binary decisions per byte and no continuation flags or EOF code. Compressing is as
+ * fpaq0f2_compress() and fpaq0f2_model_compress(). Decompressing writes exactly n bytes
+ * and returns n, or SIZE_MAX on error, such as input that ends before the value does.
+ * A frozen model trained on the same values of variable length codes them well.
+ */
+size_t fpaq0f2_compress_fixed(const void * in, size_t len, void * out, size_t bufsize);
+size_t fpaq0f2_decompress_fixed(const void * in, size_t len, void * out, size_t n);
+size_t fpaq0f2_model_compress_fixed(const fpaq0f2_model * model, const void * in, size_t len,
+                                    void * out, size_t bufsize);
+size_t fpaq0f2_model_decompress_fixed(const fpaq0f2_model * model, const void * in, size_t len,
+                                      void * out, size_t n);
+
+/* Compress count fixed width values packed in [in, in + width * count), each as by
+ * fpaq0f2_model_compress_fixed(), back to back into out, with no setup between values.
+ * The k-th value is compressed into [out + offsets[k], out + offsets[k + 1]), so offsets
+ * must hold count + 1 entries. Return offsets[count], or bufsize + 1 if the output does
+ * not fit. On error, return SIZE_MAX.
+ */
+size_t fpaq0f2_model_compress_batch(const fpaq0f2_model * model, const void * in, size_t width,
+                                    size_t count, void * out, size_t bufsize, size_t * offsets);
+
+/* Decompress count values compressed by fpaq0f2_model_compress_batch() out of [in,
+ * in + len), into width * count bytes at out. Return width * count, or SIZE_MAX on error.
+ */
+size_t fpaq0f2_model_decompress_batch(const fpaq0f2_model * model, const void * in, size_t len,
+                                      const size_t * offsets, size_t count, size_t width,
+                                      void * out);
+
+/* Tokenizing rewrites decimal numbers, runs of hex digits, UUIDs and ISO 8601 timestamps
+ * embedded in text as compact binary tokens, escaped by 0xff, and leaves the other bytes
+ * as they are, except 0xff which becomes 2 bytes. It is exactly reversed by detokenizing.
+ * Which kinds pay off depends on the data and the model: with a trained model, digits
+ * and hex digits already code to about 4 bits each, and only the structure of UUIDs and
+ * timestamps is saved.
+ */
+#define FPAQ0F2_TOKEN_DECIMAL   1 /* 4..19 digits, with no leading zero */
+#define FPAQ0F2_TOKEN_HEX       2 /* a word of 8 or more hex digits, with letters of one case */
+#define FPAQ0F2_TOKEN_UUID      4 /* 8-4-4-4-12 hex digits, with letters of one case */
+#define FPAQ0F2_TOKEN_TIMESTAMP 8 /* YYYY-MM-DDThh:mm:ss[.fff[fff[fff]]][Z], or with a space */
+#define FPAQ0F2_TOKEN_ALL      15
+
+/* Tokenize the kinds of runs in [in, in + len), or detokenize any tokens. Return the
+ * output size, or bufsize + 1 if it does not fit, leaving out undefined. Tokenizing takes
+ * at most 2 * len bytes. On error, such as an invalid token, return SIZE_MAX.
+ */
+size_t fpaq0f2_tokenize(const void * in, size_t len, void * out, size_t bufsize, int kinds);
+size_t fpaq0f2_detokenize(const void * in, size_t len, void * out, size_t bufsize);
+
+/* Tokenize, then compress as by fpaq0f2_model_compress(), or by fpaq0f2_compress() when
+ * model is NULL; and the reverse. A model for these should be trained on samples
+ * tokenized with the same kinds. If the output does not fit, return bufsize + 1, leaving
+ * out undefined.
+ */
+size_t fpaq0f2_token_compress(const fpaq0f2_model * model, const void * in, size_t len,
+                              void * out, size_t bufsize, int kinds);
+size_t fpaq0f2_token_decompress(const fpaq0f2_model * model, const void * in, size_t len,
+                                void * out, size_t bufsize);
+
+/* A frame wraps a compressed value with its uncompressed length, the id of its model and
+ * an optional CRC32C, so a decoder rejects a corrupt, truncated or mismatched input
+ * before decoding it, and checks the decoded length. The header takes 3 bytes, plus 4
+ * for the model id, plus 4 for the CRC.
+ */
+#define FPAQ0F2_FRAME_MODEL 1 /* coded by a frozen model, whose id follows the length */
+#define FPAQ0F2_FRAME_CRC   2 /* a CRC32C of the whole frame follows */
+
+typedef struct fpaq0f2_frame_info {
+    size_t length;      /* uncompressed length */
+    size_t header_size; /* the payload starts here */
+    uint32_t model_id;  /* 0 without FPAQ0F2_FRAME_MODEL */
+    int flags;          /* FPAQ0F2_FRAME_* */
+} fpaq0f2_frame_info;
+
+/* Parse a frame header. Return 0, or -1 if it is not a valid one. */
+int fpaq0f2_frame_parse(const void * in, size_t len, fpaq0f2_frame_info * info);
+
+/* Frame [in, in + len) compressed as by fpaq0f2_model_compress(), or as by
+ * fpaq0f2_compress() when model is NULL, with flags 0 or FPAQ0F2_FRAME_CRC. Return the
+ * frame size, or bufsize + 1 if it does not fit, leaving out undefined. On error, return
+ * SIZE_MAX.
+ */
+size_t fpaq0f2_frame_compress(const fpaq0f2_model * model, const void * in, size_t len,
+                              void * out, size_t bufsize, int flags);
+
+/* Decompress a whole frame [in, in + len) as fpaq0f2_decompress() does. The model must
+ * be the one named in the frame, or NULL when it names none. A bad header, model id or
+ * CRC fails before decoding, and a payload that does not decode to exactly the framed
+ * length fails as soon as that shows. On failure, return SIZE_MAX.
+ */
+size_t fpaq0f2_frame_decompress(const fpaq0f2_model * model, const void * in, size_t len,
+                                void * out, size_t bufsize);
+
+/* A byte iterator decodes a frozen-model compressed value one byte at a time, on demand,
+ * with no output buffer, so a consumer pulls only as many bytes as it needs. It holds
+ * the whole decoder state inline, needs no allocation and may live on the stack. The
+ * model and the compressed bytes must outlive it, and it may be copied to save a position.
+ */
+typedef struct fpaq0f2_iter {
+    union {
+        void * align;
+        unsigned char bytes[384];
+    } opaque;
+} fpaq0f2_iter;
+
+/* Start iterating over [in, in + len) compressed by fpaq0f2_model_compress() with the
+ * same model (NULL means fpaq0f2_model_default()). Return 0, or -1 on error.
+ */
+int fpaq0f2_iter_init(fpaq0f2_iter * it, const fpaq0f2_model * model, const void * in, size_t len);
+
+/* Return the next decompressed byte (0..255), or -1 after the last one. */
+int fpaq0f2_iter_next(fpaq0f2_iter * it);
+
+/* A stream compresses or decompresses one value in chunks of any size, keeping the coder
+ * and the model between calls. It does not need the whole input or output in memory.
+ */
+typedef struct fpaq0f2_stream fpaq0f2_stream;
+
+/* Return codes of fpaq0f2_stream_update() and fpaq0f2_stream_finish(). */
+#define FPAQ0F2_STREAM_ERROR (-1) /* invalid arguments, or more input after finishing */
+#define FPAQ0F2_STREAM_OK      0  /* all output is written, more input is wanted */
+#define FPAQ0F2_STREAM_FULL    1  /* the output buffer is full, call again with more room */
+#define FPAQ0F2_STREAM_END     2  /* the whole value is written */
+
+/* Create a stream in the format of fpaq0f2_compress(), or of fpaq0f2_model_compress()
+ * with a frozen model (NULL means fpaq0f2_model_default()). The model must outlive the
+ * stream. Return NULL on error.
+ */
+fpaq0f2_stream * fpaq0f2_stream_new(int decompress);
+fpaq0f2_stream * fpaq0f2_model_stream_new(const fpaq0f2_model * model, int decompress);
+
+void fpaq0f2_stream_free(fpaq0f2_stream * s);
+
+/* Start coding a new value with the same stream. */
+void fpaq0f2_stream_reset(fpaq0f2_stream * s);
+
+/* Code [in, in + len) into [out, out + bufsize), and set *in_used and *out_used to the
+ * bytes read and written. Input that is not used must be passed again. A decompressing
+ * stream returns FPAQ0F2_STREAM_END once the value is complete, ignoring any input left.
+ */
+int fpaq0f2_stream_update(fpaq0f2_stream * s, const void * in, size_t len, size_t * in_used,
+                          void * out, size_t bufsize, size_t * out_used);
+
+/* Tell the stream there is no more input, and write the rest of the output into
+ * [out, out + bufsize). Call again while it returns FPAQ0F2_STREAM_FULL.
+ */
+int fpaq0f2_stream_finish(fpaq0f2_stream * s, void * out, size_t bufsize, size_t * out_used);
+
+/* A queue runs jobs on a pool of worker threads, so that a thread which must not spend
+ * microseconds compressing hands values off instead. Jobs are submitted to a lock-free
+ * ring that all workers take from, and each worker keeps a context, so adaptive jobs
+ * reuse its model. A job with a done callback is passed to it by the worker when
+ * complete; any other job is pushed to a lock-free completion ring for
+ * fpaq0f2_queue_poll(). Submitting a job costs one ring push, and wakes a worker only
+ * if all of them sleep.
+ */
+typedef struct fpaq0f2_queue fpaq0f2_queue;
+
+#define FPAQ0F2_JOB_COMPRESS   0
+#define FPAQ0F2_JOB_DECOMPRESS 1
+
+/* A job belongs to the caller, which must keep it and its buffers alive until it
+ * completes, and must not touch them meanwhile.
+ */
+typedef struct fpaq0f2_job {
+    int op;                        /* FPAQ0F2_JOB_* */
+    const fpaq0f2_model * model;   /* frozen model, or NULL for fpaq0f2_compress() format */
+    const void * in;
+    size_t len;
+    void * out;
+    size_t bufsize;
+    void (*done)(struct fpaq0f2_job * job);  /* called by a worker, or NULL to poll */
+    void * user;                   /* for the caller */
+    size_t result;                 /* as returned by fpaq0f2_compress() and the like */
+} fpaq0f2_job;
+
+/* Create a queue with workers threads, or one per CPU if 0, and room for depth jobs,
+ * rounded up to a power of two, in each ring. Return NULL on error.
+ */
+fpaq0f2_queue * fpaq0f2_queue_new(unsigned workers, size_t depth);
+
+/* Run the jobs still submitted, then stop the workers and free the queue. Completions
+ * not yet polled are dropped.
+ */
+void fpaq0f2_queue_free(fpaq0f2_queue * q);
+
+/* Submit a job and return 0, or return -1 if the ring is full. Any thread may submit,
+ * including a done callback.
+ */
+int fpaq0f2_queue_submit(fpaq0f2_queue * q, fpaq0f2_job * job);
+
+/* Submit jobs[0, n) in order, waking the sleeping workers once for all of them, and
+ * return how many were submitted before the ring filled.
+ */
+size_t fpaq0f2_queue_submit_batch(fpaq0f2_queue * q, fpaq0f2_job * const * jobs, size_t n);
+
+/* Store up to max completed jobs without a done callback into jobs, and return their
+ * number, 0 if none is complete yet. Any thread may poll, but often enough: a worker
+ * whose completion ring is full waits for room.
+ */
+size_t fpaq0f2_queue_poll(fpaq0f2_queue * q, fpaq0f2_job ** jobs, size_t max);
+
 #ifdef __cplusplus
 }
 #endif
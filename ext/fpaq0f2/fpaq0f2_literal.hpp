@@ -0,0 +1,198 @@
+#ifndef __FPAQ0F2_LITERAL_HPP__
+#define __FPAQ0F2_LITERAL_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+#include <string_view>
+
+/* Compile time compression of string literals:
+ *
+ *   std::string_view sql = FPAQ0F2_LITERAL("SELECT ... a long query ...");
+ *
+ * compresses the literal while compiling, so that only its compressed bytes are in the
+ * binary, and expands it into zeroed static storage the first time the expression
+ * runs, thread safely. Every run returns the same view, which is also NUL terminated.
+ * Until then the literal costs its compressed bytes and a call, and is never paged in.
+ *
+ * The coder is the Encoder and FrozenPredictor of fpaq0f2.cpp in fixed width with the
+ * default model, whose predictions only depend on the bit history of each context and
+ * so need no table: the compressed bytes are those of
+ * fpaq0f2_model_compress_fixed(NULL, ...). Messages and SQL shrink by 15 to 20%. A
+ * literal that would not shrink is kept as it is. Neither compressing nor expanding
+ * needs the library, nor its 128 KB default model at run time. Compiling costs about
+ * 0.1 ms per literal byte with GCC, so it pays for long literals more than for short.
+ */
+
+namespace fpaq0f2 {
+namespace detail {
+
+// P(1) of a context of the default model, as a multiple of 1/16: 3 plus the 1 bits of
+// its bit history h, the last two counting double. A table, as a constant expression
+// evaluates a lookup much faster than the sum.
+struct literal_weights {
+  uint8_t w[256];
+  constexpr literal_weights(): w() {
+    for (int h = 0; h < 256; ++h)
+      w[h] = (uint8_t)((h & 1) * 2 + (h & 2) + (h >> 2 & 1) + (h >> 3 & 1) + (h >> 4 & 1) + (h >> 5 & 1) +
+                       (h >> 6 & 1) + (h >> 7 & 1) + 3);
+  }
+};
+inline constexpr literal_weights literal_p{};
+
+// A literal of N bytes compressed into bytes[0, size). A bit costs at most
+// log2(16/3) < 2.5 bits, so the bytes hold any N.
+template <size_t N>
+struct compressed_literal {
+  uint8_t bytes[N * 5 / 2 + 8];
+  size_t size;
+};
+
+// The fixed width Encoder of fpaq0f2.cpp with a FrozenPredictor of the default model,
+// compressing while compiling. It is one function working on locals, which GCC
+// evaluates as a constant expression about twice as fast as member functions.
+template <size_t N>
+constexpr compressed_literal<N> compress_literal(const char *s) {
+  compressed_literal<N> r{};
+  uint32_t x1 = 0, x2 = 0xffffffff;
+  uint8_t state[256] = {};
+  for (int i = 0; i < 256; ++i) state[i] = 0x66;
+  size_t n = 0;
+  for (size_t k = 0; k < N; ++k) {
+    const int c = (uint8_t)s[k];
+    for (int i = 7, cxt = 1; i >= 0; --i) {
+      const int y = c >> i & 1;
+      uint8_t &st = state[cxt];
+      const uint32_t p = (uint32_t)literal_p.w[st] << 12;
+      const uint32_t xmid = x1 + ((x2 - x1) >> 16) * p + (((x2 - x1) & 0xffff) * p >> 16);
+      if (y) x2 = xmid;
+      else x1 = xmid + 1;
+      st = (uint8_t)(st * 2 + y);
+      cxt += cxt + y;
+      while (((x1 ^ x2) & 0xff000000) == 0) {
+        r.bytes[n++] = (uint8_t)(x2 >> 24);
+        x1 <<= 8;
+        x2 = (x2 << 8) + 255;
+      }
+    }
+  }
+  while (((x1 ^ x2) & 0xff000000) == 0) {
+    r.bytes[n++] = (uint8_t)(x2 >> 24);
+    x1 <<= 8;
+    x2 = (x2 << 8) + 255;
+  }
+  r.bytes[n++] = (uint8_t)(x2 >> 24);  // first unequal byte
+  r.size = n;
+  return r;
+}
+
+// Decompresses what compress_literal() wrote, at run time.
+class literal_decoder {
+public:
+  // Start decoding [in, in + len), reading zeros past its end.
+  literal_decoder(const uint8_t *in, size_t len): in(in), len(len), n(0), x1(0), x2(0xffffffff), x(0), cxt(1) {
+    memset(state, 0x66, sizeof(state));
+    for (int i = 0; i < 4; ++i) x = (x << 8) + next();
+  }
+
+  int decode() {
+    uint8_t &st = state[cxt];
+    const uint32_t p = (uint32_t)literal_p.w[st] << 12;
+    const uint32_t xmid = x1 + ((x2 - x1) >> 16) * p + (((x2 - x1) & 0xffff) * p >> 16);
+    const int y = x <= xmid;
+    if (y) x2 = xmid;
+    else x1 = xmid + 1;
+    st = (uint8_t)(st * 2 + y);
+    if ((cxt += cxt + y) >= 256) cxt = 1;
+    while (((x1 ^ x2) & 0xff000000) == 0) {
+      x1 <<= 8;
+      x2 = (x2 << 8) + 255;
+      x = (x << 8) + next();
+    }
+    return y;
+  }
+
+private:
+  const uint8_t *const in;
+  const size_t len;
+  size_t n;         // bytes of in read
+  uint32_t x1, x2;  // range, initially [0, 1), scaled by 2^32
+  uint32_t x;       // last 4 compressed bytes
+  int cxt;          // 1..255, the bits of the byte so far with a leading 1
+  uint8_t state[256];
+
+  uint32_t next() { return n < len ? in[n++] : 0; }
+};
+
+// A literal of N bytes stored in M: compressed if M < N, as it is otherwise.
+template <size_t N, size_t M>
+struct packed_literal {
+  uint8_t bytes[M ? M : 1];
+};
+
+template <size_t N, size_t M>
+constexpr packed_literal<N, M> pack(const char *s, const compressed_literal<N> &c) {
+  packed_literal<N, M> r{};
+  for (size_t k = 0; k < M; ++k) r.bytes[k] = M == N ? (uint8_t)s[k] : c.bytes[k];
+  return r;
+}
+
+// Expand the n bytes of a literal stored in [in, in + m) into out. One function for all
+// literals, so each only adds its bytes and a call.
+inline void unpack(const uint8_t *in, size_t m, char *out, size_t n) {
+  if (m == n) {
+    memcpy(out, in, n);
+    return;
+  }
+  literal_decoder d(in, m);
+  for (size_t k = 0; k < n; ++k) {
+    int c = 1;
+    while (c < 256) c += c + d.decode();
+    out[k] = (char)(c - 256);
+  }
+}
+
+// Where a literal is expanded, in zeroed static storage that costs no binary size.
+template <size_t N>
+struct expanded_literal {
+  std::atomic<bool> ready;
+  char text[N + 1];
+};
+
+// Expand a literal on its first use, and return it. The first use of each literal takes
+// a lock shared by all of them, later ones only test ready.
+inline std::string_view expand(const uint8_t *in, size_t m, std::atomic<bool> &ready, char *text, size_t n) {
+  if (!ready.load(std::memory_order_acquire)) {
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!ready.load(std::memory_order_relaxed)) {
+      unpack(in, m, text, n);
+      text[n] = 0;
+      ready.store(true, std::memory_order_release);
+    }
+  }
+  return std::string_view(text, n);
+}
+
+} // namespace detail
+} // namespace fpaq0f2
+
+/* The string literal s, compressed at compile time and expanded on first use, as a
+ * std::string_view. s may hold NULs.
+ */
+#define FPAQ0F2_LITERAL(s)                                                                    \
+  ([]() -> std::string_view {                                                                 \
+    using namespace ::fpaq0f2::detail;                                                        \
+    static constexpr size_t fpaq0f2_n = sizeof(s) - 1;                                        \
+    static constexpr compressed_literal<fpaq0f2_n> fpaq0f2_c = compress_literal<fpaq0f2_n>(s); \
+    static constexpr size_t fpaq0f2_m = fpaq0f2_c.size < fpaq0f2_n ? fpaq0f2_c.size : fpaq0f2_n; \
+    static constexpr packed_literal<fpaq0f2_n, fpaq0f2_m> fpaq0f2_packed =                    \
+        pack<fpaq0f2_n, fpaq0f2_m>(s, fpaq0f2_c);                                             \
+    static expanded_literal<fpaq0f2_n> fpaq0f2_text;                                          \
+    return expand(fpaq0f2_packed.bytes, fpaq0f2_m, fpaq0f2_text.ready, fpaq0f2_text.text, fpaq0f2_n); \
+  }())
+
+#endif /* __FPAQ0F2_LITERAL_HPP__ */
@@ -0,0 +1,194 @@
+#ifndef __FPAQ0F2_MAP_HPP__
+#define __FPAQ0F2_MAP_HPP__
+
+#include <string.h>
+
+#include <functional>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "fpaq0f2_string.hpp"
+
+namespace fpaq0f2 {
+
+/* A compressed_probe compresses a lookup key once, into a stack buffer when the
+ * result is short, so it can be matched against stored keys byte for byte.
+ */
+template <class Model = default_model>
+class compressed_probe {
+public:
+  explicit compressed_probe(std::string_view s) {
+    n = fpaq0f2_model_compress(Model::get(), s.data(), s.size(), buf, sizeof(buf));
+    p = buf;
+    if (n <= sizeof(buf)) return;
+    if (SIZE_MAX == n) throw std::invalid_argument("fpaq0f2_model_compress");
+    for (spill.resize(s.size() + s.size() / 2 + sizeof(buf)); ; spill.resize(spill.size() * 2)) {
+      n = fpaq0f2_model_compress(Model::get(), s.data(), s.size(), spill.data(), spill.size());
+      if (n <= spill.size()) break;
+    }
+    p = spill.data();
+  }
+
+  std::string_view bytes() const { return std::string_view((const char *)p, n); }
+
+private:
+  unsigned char buf[256];
+  std::vector<unsigned char> spill;
+  const unsigned char *p;
+  size_t n;
+};
+
+namespace detail {
+
+// Hash and equality over compressed bytes; transparent, so a probe's bytes can be
+// looked up without building a key where the library supports it.
+template <class Model>
+struct compressed_hash {
+  typedef void is_transparent;
+  size_t operator()(std::string_view b) const noexcept {
+    return std::hash<std::string_view>()(b);
+  }
+  size_t operator()(const basic_compressed_string<Model> &k) const noexcept {
+    return (*this)(view(k));
+  }
+  static std::string_view view(const basic_compressed_string<Model> &k) {
+    return std::string_view((const char *)k.data(), k.compressed_size());
+  }
+};
+
+template <class Model>
+struct compressed_equal {
+  typedef void is_transparent;
+  template <class A, class B>
+  bool operator()(const A &a, const B &b) const noexcept { return bytes(a) == bytes(b); }
+  static std::string_view bytes(std::string_view b) { return b; }
+  static std::string_view bytes(const basic_compressed_string<Model> &k) {
+    return compressed_hash<Model>::view(k);
+  }
+};
+
+// Find the probe's compressed bytes in an unordered container keyed by compressed strings.
+template <class Model, class C>
+auto find_compressed(C &c, const compressed_probe<Model> &probe) {
+#if defined(__cpp_lib_generic_unordered_lookup)
+  return c.find(probe.bytes());
+#else
+  const std::string_view b = probe.bytes();
+  return c.find(basic_compressed_string<Model>::from_compressed(b.data(), b.size()));
+#endif
+}
+
+} // namespace detail
+
+/* A compressed_key_map is an unordered map from strings to T which stores only the
+ * frozen-model compressed keys. Keys are hashed and compared as compressed bytes, and
+ * a lookup compresses the probe once instead of decompressing any stored key. The
+ * model must be the same for the whole life of the map.
+ */
+template <class T, class Model = default_model>
+class compressed_key_map {
+public:
+  typedef basic_compressed_string<Model> key_type;
+  typedef T mapped_type;
+  typedef std::unordered_map<key_type, T, detail::compressed_hash<Model>,
+                             detail::compressed_equal<Model> > map_type;
+  typedef typename map_type::value_type value_type;
+  typedef typename map_type::iterator iterator;
+  typedef typename map_type::const_iterator const_iterator;
+
+  iterator find(std::string_view k) { return find(compressed_probe<Model>(k)); }
+  const_iterator find(std::string_view k) const { return find(compressed_probe<Model>(k)); }
+  iterator find(const compressed_probe<Model> &k) { return detail::find_compressed(m, k); }
+  const_iterator find(const compressed_probe<Model> &k) const { return detail::find_compressed(m, k); }
+
+  bool contains(std::string_view k) const { return end() != find(k); }
+  size_t count(std::string_view k) const { return contains(k); }
+
+  T &at(std::string_view k) {
+    iterator it = find(k);
+    if (end() == it) throw std::out_of_range("compressed_key_map::at");
+    return it->second;
+  }
+  const T &at(std::string_view k) const {
+    const_iterator it = find(k);
+    if (end() == it) throw std::out_of_range("compressed_key_map::at");
+    return it->second;
+  }
+
+  T &operator[](std::string_view k) { return m[key_type(k)]; }
+
+  template <class... Args>
+  std::pair<iterator, bool> emplace(std::string_view k, Args &&...args) {
+    return m.try_emplace(key_type(k), std::forward<Args>(args)...);
+  }
+  std::pair<iterator, bool> insert(std::string_view k, const T &v) { return emplace(k, v); }
+  template <class V>
+  std::pair<iterator, bool> insert_or_assign(std::string_view k, V &&v) {
+    return m.insert_or_assign(key_type(k), std::forward<V>(v));
+  }
+
+  size_t erase(std::string_view k) {
+    iterator it = find(k);
+    if (end() == it) return 0;
+    m.erase(it);
+    return 1;
+  }
+  iterator erase(const_iterator it) { return m.erase(it); }
+
+  iterator begin() { return m.begin(); }
+  iterator end() { return m.end(); }
+  const_iterator begin() const { return m.begin(); }
+  const_iterator end() const { return m.end(); }
+
+  size_t size() const { return m.size(); }
+  bool empty() const { return m.empty(); }
+  void clear() { m.clear(); }
+  void reserve(size_t n) { m.reserve(n); }
+
+private:
+  map_type m;
+};
+
+/* A compressed_key_set is the set counterpart of compressed_key_map. */
+template <class Model = default_model>
+class compressed_key_set {
+public:
+  typedef basic_compressed_string<Model> key_type;
+  typedef std::unordered_set<key_type, detail::compressed_hash<Model>,
+                             detail::compressed_equal<Model> > set_type;
+  typedef typename set_type::iterator iterator;
+  typedef typename set_type::const_iterator const_iterator;
+
+  const_iterator find(std::string_view k) const { return find(compressed_probe<Model>(k)); }
+  const_iterator find(const compressed_probe<Model> &k) const { return detail::find_compressed(s, k); }
+
+  bool contains(std::string_view k) const { return end() != find(k); }
+  size_t count(std::string_view k) const { return contains(k); }
+
+  std::pair<iterator, bool> insert(std::string_view k) { return s.insert(key_type(k)); }
+  size_t erase(std::string_view k) {
+    const_iterator it = find(k);
+    if (end() == it) return 0;
+    s.erase(it);
+    return 1;
+  }
+
+  const_iterator begin() const { return s.begin(); }
+  const_iterator end() const { return s.end(); }
+
+  size_t size() const { return s.size(); }
+  bool empty() const { return s.empty(); }
+  void clear() { s.clear(); }
+  void reserve(size_t n) { s.reserve(n); }
+
+private:
+  set_type s;
+};
+
+} // namespace fpaq0f2
+
+#endif /* __FPAQ0F2_MAP_HPP__ */
@@ -0,0 +1,260 @@
+#ifndef __FPAQ0F2_STRING_HPP__
+#define __FPAQ0F2_STRING_HPP__
+
+#include <stdint.h>
+#include <string.h>
+
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "fpaq0f2.h"
+
+namespace fpaq0f2 {
+
+/* Picks the frozen model shared by all strings of one type. Strings built with
+ * different models must not be mixed, so a domain with its own trained model
+ * declares its own tag:
+ *
+ *   struct url_model { static const fpaq0f2_model *get() { return g_url_model; } };
+ *   typedef fpaq0f2::basic_compressed_string<url_model> compressed_url;
+ */
+struct default_model {
+  static const fpaq0f2_model *get() { return fpaq0f2_model_default(); }
+};
+
+/* An input iterator over the bytes of a frozen-model compressed value, decoded lazily
+ * by fpaq0f2_iter_next(). A default constructed byte_iterator is the end.
+ */
+class byte_iterator {
+public:
+  typedef std::input_iterator_tag iterator_category;
+  typedef char value_type;
+  typedef ptrdiff_t difference_type;
+  typedef const char *pointer;
+  typedef const char &reference;
+
+  byte_iterator(): c(-1) {}
+  byte_iterator(const fpaq0f2_model *model, const void *in, size_t len) {
+    if (fpaq0f2_iter_init(&it, model, in, len)) throw std::invalid_argument("fpaq0f2_iter_init");
+    next();
+  }
+
+  reference operator*() const { return value; }
+  byte_iterator &operator++() {
+    next();
+    return *this;
+  }
+  byte_iterator operator++(int) {
+    byte_iterator old(*this);
+    ++*this;
+    return old;
+  }
+
+  // Iterators only compare equal at the end.
+  friend bool operator==(const byte_iterator &a, const byte_iterator &b) { return a.c < 0 && b.c < 0; }
+  friend bool operator!=(const byte_iterator &a, const byte_iterator &b) { return !(a == b); }
+
+private:
+  fpaq0f2_iter it;
+  int c;       // the current byte, or -1 at the end
+  char value;
+
+  void next() {
+    c = fpaq0f2_iter_next(&it);
+    value = (char)c;
+  }
+};
+
+/* A compressed_string keeps the fpaq0f2 compressed bytes of a string in a 24 byte
+ * object. Up to 23 compressed bytes are stored inline, longer values spill to the
+ * heap. Equality and ordering are computed on the compressed bytes, which is exact
+ * because a frozen model codes equal strings to equal bytes, and codes in the
+ * reverse order of the uncompressed bytes.
+ */
+template <class Model = default_model>
+class basic_compressed_string {
+public:
+  static const size_t inline_capacity = 23;
+
+  basic_compressed_string() { set_inline(NULL, 0); }
+
+  explicit basic_compressed_string(std::string_view s) {
+    unsigned char buf[inline_capacity];
+    size_t n = fpaq0f2_model_compress(Model::get(), s.data(), s.size(), buf, sizeof(buf));
+    if (n <= sizeof(buf)) {
+      set_inline(buf, n);
+      return;
+    }
+    if (SIZE_MAX == n) throw std::invalid_argument("fpaq0f2_model_compress");
+
+    // Spill: retry with a larger buffer until the value fits.
+    for (size_t cap = s.size() + s.size() / 2 + 2 * sizeof(buf); ; cap *= 2) {
+      unsigned char *p = new unsigned char[cap];
+      n = fpaq0f2_model_compress(Model::get(), s.data(), s.size(), p, cap);
+      if (n <= cap) {
+        set_heap(p, n);
+        return;
+      }
+      delete[] p;
+    }
+  }
+
+  // Adopt bytes already compressed with the same model.
+  static basic_compressed_string from_compressed(const void *p, size_t n) {
+    basic_compressed_string s;
+    if (n <= inline_capacity) {
+      s.set_inline((const unsigned char *)p, n);
+    } else {
+      unsigned char *h = new unsigned char[n];
+      memcpy(h, p, n);
+      s.set_heap(h, n);
+    }
+    return s;
+  }
+
+  basic_compressed_string(const basic_compressed_string &o) {
+    if (o.is_inline()) {
+      memcpy(u.bytes, o.u.bytes, sizeof(u.bytes));
+    } else {
+      unsigned char *p = new unsigned char[o.u.heap.size];
+      memcpy(p, o.u.heap.ptr, o.u.heap.size);
+      set_heap(p, o.u.heap.size);
+    }
+  }
+
+  basic_compressed_string(basic_compressed_string &&o) noexcept {
+    memcpy(u.bytes, o.u.bytes, sizeof(u.bytes));
+    o.set_inline(NULL, 0);
+  }
+
+  basic_compressed_string &operator=(basic_compressed_string o) noexcept {
+    swap(o);
+    return *this;
+  }
+
+  ~basic_compressed_string() {
+    if (!is_inline()) delete[] u.heap.ptr;
+  }
+
+  void swap(basic_compressed_string &o) noexcept {
+    unsigned char tmp[sizeof(u.bytes)];
+    memcpy(tmp, u.bytes, sizeof(tmp));
+    memcpy(u.bytes, o.u.bytes, sizeof(tmp));
+    memcpy(o.u.bytes, tmp, sizeof(tmp));
+  }
+
+  // The compressed bytes.
+  const unsigned char *data() const { return is_inline() ? u.bytes : u.heap.ptr; }
+  size_t compressed_size() const { return is_inline() ? u.bytes[tag] : u.heap.size; }
+  bool is_inline() const { return heap_tag != u.bytes[tag]; }
+
+  // Decode the bytes lazily, with no buffer.
+  byte_iterator begin() const { return byte_iterator(Model::get(), data(), compressed_size()); }
+  byte_iterator end() const { return byte_iterator(); }
+
+  // Whether the string starts with prefix, decoding no more than its length.
+  bool starts_with(std::string_view prefix) const {
+    if (prefix.empty()) return true;
+    byte_iterator it = begin();  // decodes the first byte
+    for (size_t i = 0; ; ++it) {
+      if (end() == it || *it != prefix[i]) return false;
+      if (++i == prefix.size()) return true;
+    }
+  }
+
+  /* Decompress into [buf, buf + return) if bufsize is large enough, otherwise return
+   * bufsize + 1 with the first bufsize bytes filled, as fpaq0f2_model_decompress().
+   */
+  size_t copy(char *buf, size_t bufsize) const {
+    return fpaq0f2_model_decompress(Model::get(), data(), compressed_size(), buf, bufsize);
+  }
+
+  std::string str() const {
+    std::string s(compressed_size() * 4 + 16, '\0');
+    for (;;) {
+      const size_t n = copy(&s[0], s.size());
+      if (n <= s.size()) {
+        s.resize(n);
+        return s;
+      }
+      s.resize(s.size() * 2);
+    }
+  }
+
+  // <0, 0, >0 as the uncompressed strings compare, without decompressing.
+  int compare(const basic_compressed_string &o) const {
+    const size_t n = compressed_size(), on = o.compressed_size();
+    const int r = memcmp(o.data(), data(), n < on ? n : on);
+    if (r) return r;
+    return on < n ? -1 : on > n;
+  }
+
+  friend bool operator==(const basic_compressed_string &a, const basic_compressed_string &b) {
+    return a.compressed_size() == b.compressed_size() &&
+           0 == memcmp(a.data(), b.data(), a.compressed_size());
+  }
+  friend bool operator!=(const basic_compressed_string &a, const basic_compressed_string &b) {
+    return !(a == b);
+  }
+  friend bool operator<(const basic_compressed_string &a, const basic_compressed_string &b) {
+    return a.compare(b) < 0;
+  }
+  friend bool operator>(const basic_compressed_string &a, const basic_compressed_string &b) {
+    return b < a;
+  }
+  friend bool operator<=(const basic_compressed_string &a, const basic_compressed_string &b) {
+    return !(b < a);
+  }
+  friend bool operator>=(const basic_compressed_string &a, const basic_compressed_string &b) {
+    return !(a < b);
+  }
+
+private:
+  // The last byte tags the layout: an inline size (0..23), or heap_tag.
+  static const size_t tag = inline_capacity;
+  static const unsigned char heap_tag = 0xff;
+
+  union {
+    unsigned char bytes[inline_capacity + 1];
+    struct {
+      unsigned char *ptr;
+      size_t size;
+    } heap;
+  } u;
+
+  void set_inline(const unsigned char *p, size_t n) {
+    memset(u.bytes, 0, sizeof(u.bytes));
+    if (n) memcpy(u.bytes, p, n);
+    u.bytes[tag] = (unsigned char)n;
+  }
+
+  void set_heap(unsigned char *p, size_t n) {
+    memset(u.bytes, 0, sizeof(u.bytes));
+    u.heap.ptr = p;
+    u.heap.size = n;
+    u.bytes[tag] = heap_tag;
+  }
+
+  static_assert(sizeof(u.heap) < inline_capacity, "tag byte overlaps the heap pointer");
+};
+
+typedef basic_compressed_string<> compressed_string;
+
+static_assert(sizeof(void *) != 8 || sizeof(compressed_string) == 24, "compressed_string is 24 bytes");
+
+} // namespace fpaq0f2
+
+namespace std {
+template <class Model>
+struct hash<fpaq0f2::basic_compressed_string<Model> > {
+  size_t operator()(const fpaq0f2::basic_compressed_string<Model> &s) const noexcept {
+    return hash<string_view>()(string_view((const char *)s.data(), s.compressed_size()));
+  }
+};
+} // namespace std
+
+#endif /* __FPAQ0F2_STRING_HPP__ */
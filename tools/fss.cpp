@@ -0,0 +1,785 @@
+/* fss - compress files with fpaq0f2, as whole streams or as indexed sets of records.
+
+To compile: g++ -O2 -std=c++17 -pthread -I../ext/fpaq0f2 fss.cpp ../ext/fpaq0f2/fpaq0f2.cpp
+To run:     fss c [-b KiB] [-t threads] [-m model] input output
+            fss r [-z | -l] [-b KiB] [-t threads] [-m model] input output
+            fss d [-t threads] [-m model] input output
+            fss g [-m model] input index ...
+            input and output may be - for stdin and stdout
+
+c compresses a whole stream, cut into blocks of -b KiB (default 1024) that
+are compressed on their own, so that they code in parallel. r compresses a
+set of records: lines (default), NUL terminated strings (-z), or the
+LEB128 length-prefixed records of bench/corpus.h (-l). Each record is
+compressed on its own, as the short strings this library is for, and
+blocks of records carry the index of their records, and the file a table
+of its blocks, so that g prints the records of the given numbers (from 0)
+by decoding only those. d decompresses either kind of file.
+
+Values are compressed as by fpaq0f2_compress(), or by
+fpaq0f2_model_compress() with a model saved by tools/fss_train, which
+decompressing then needs too.
+
+A reader thread cuts the input into blocks, -t worker threads (default
+one per CPU) code them, and the main thread writes them in order, with at
+most two blocks per worker in flight. A regular file is read by mmap(),
+and its blocks are slices of the mapping; other input by large read()s.
+
+File formats, with integers in little endian:
+  stream   "FSC1", model id (0 if none), block size, then blocks of raw
+           length, compressed length (bit 31 set if stored raw), CRC32C of
+           the raw bytes and the compressed bytes; a raw length of 0 ends it.
+  records  "FSR1", model id, record kind (0 lines, 1 NUL, 2 LEB128), then
+           blocks of record count, flags (1 if the last record has no
+           terminator), size and CRC32C of the rest of the block, the end
+           offsets of the compressed records and the compressed records; a
+           count of 0 ends them, and is followed by the offset and first
+           record number of each block as 64 bit integers, the offset of
+           this table and the number of blocks, and "FSRX".
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "fpaq0f2.h"
+
+// The types below are this program's own; the library has a Mode too, and
+// they must not meet it in a link time optimized build.
+namespace {
+
+//////////////////////////// formats ////////////////////////////
+
+static const char STREAM_MAGIC[4] = {'F', 'S', 'C', '1'};
+static const char RECORDS_MAGIC[4] = {'F', 'S', 'R', '1'};
+static const char TABLE_MAGIC[4] = {'F', 'S', 'R', 'X'};
+static const size_t FILE_HEADER = 12;
+static const size_t STREAM_HEADER = 12;   // of a block
+static const size_t RECORDS_HEADER = 16;  // of a block
+static const size_t FOOTER = 20;
+static const uint32_t STORED = 0x80000000;
+static const uint32_t OPEN = 1;           // the last record has no terminator
+static const size_t MAX_BLOCK = 64 << 20;
+
+enum Kind { LINES, NULS, LEB128 };
+
+static void put32(char *p, uint32_t v) {
+  for (int i = 0; i < 4; ++i) p[i] = (char)(v >> 8 * i);
+}
+static void put64(char *p, uint64_t v) {
+  for (int i = 0; i < 8; ++i) p[i] = (char)(v >> 8 * i);
+}
+static uint32_t get32(const char *p) {
+  uint32_t v = 0;
+  for (int i = 3; i >= 0; --i) v = v << 8 | (uint8_t)p[i];
+  return v;
+}
+static uint64_t get64(const char *p) {
+  return get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+//////////////////////////// options ////////////////////////////
+
+static size_t g_block = 1 << 20;
+static unsigned g_threads = 0;
+static Kind g_kind = LINES;
+static fpaq0f2_model *g_model = NULL;
+
+static size_t pack(fpaq0f2_ctx *ctx, const char *in, size_t len, char *out, size_t bufsize) {
+  return g_model ? fpaq0f2_model_compress(g_model, in, len, out, bufsize)
+                 : fpaq0f2_ctx_compress(ctx, in, len, out, bufsize);
+}
+static size_t unpack(fpaq0f2_ctx *ctx, const char *in, size_t len, char *out, size_t bufsize) {
+  return g_model ? fpaq0f2_model_decompress(g_model, in, len, out, bufsize)
+                 : fpaq0f2_ctx_decompress(ctx, in, len, out, bufsize);
+}
+
+// Code with f at the end of out, starting with room bytes and growing them until the
+// result fits. Return false on error.
+template <class F>
+static bool append(std::vector<char> &out, size_t room, F f) {
+  for (;;) {
+    const size_t at = out.size();
+    out.resize(at + room);
+    const size_t n = f(out.data() + at, room);
+    if (n <= room) {
+      out.resize(at + n);
+      return true;
+    }
+    out.resize(at);
+    if (n == SIZE_MAX) return false;
+    room *= 2;
+  }
+}
+
+//////////////////////////// input and output ////////////////////////////
+
+// The input, mapped if it is a regular file, or read in large chunks into a buffer
+// otherwise, seen as a window of the bytes not consumed yet.
+class Input {
+public:
+  const char *error;  // set once reading fails
+  uint64_t size;      // bytes consumed
+
+  Input(): error(NULL), size(0), fd(-1), map(NULL), pos(0), end(0), eof(false) {}
+  ~Input() {
+    if (map) munmap(map, end);
+    if (fd > 0) close(fd);
+  }
+
+  bool open(const char *path) {
+    fd = strcmp(path, "-") ? ::open(path, O_RDONLY) : 0;
+    if (fd < 0) return false;
+    struct stat st;
+    if (0 == fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 && 0 == lseek(fd, 0, SEEK_CUR)) {
+      void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        madvise(p, st.st_size, MADV_SEQUENTIAL);
+        map = (char *)p;
+        end = st.st_size;
+        eof = true;
+      }
+    }
+    return true;
+  }
+
+  bool mapped() const { return map != NULL; }
+  const char *data() const { return (map ? map : buf.data()) + pos; }
+
+  // Make n bytes available, or all that are left, and return how many are.
+  size_t fill(size_t n) {
+    if (end - pos >= n || eof) return end - pos;
+    if (pos) {
+      memmove(buf.data(), buf.data() + pos, end - pos);
+      end -= pos;
+      pos = 0;
+    }
+    if (buf.size() < n) buf.resize(std::max(n, std::max(buf.size() * 2, (size_t)1 << 20)));
+    while (end < n && !eof) {
+      const ssize_t r = read(fd, buf.data() + end, buf.size() - end);
+      if (r < 0 && errno == EINTR) continue;
+      if (r < 0) error = strerror(errno);
+      if (r <= 0) eof = true;
+      else end += r;
+    }
+    return end - pos;
+  }
+
+  void consume(size_t n) {
+    pos += n;
+    size += n;
+  }
+
+private:
+  int fd;
+  char *map;
+  std::vector<char> buf;
+  size_t pos, end;  // the window is [pos, end) of the mapping or buf
+  bool eof;
+};
+
+class Output {
+public:
+  const char *error;
+  uint64_t size;  // bytes written
+
+  Output(): error(NULL), size(0), fd(-1), path(NULL) {}
+
+  bool open(const char *p) {
+    if (!strcmp(p, "-")) {
+      fd = 1;
+      return true;
+    }
+    path = p;
+    fd = ::open(p, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    return fd >= 0;
+  }
+
+  bool write(const void *p, size_t n) {
+    for (const char *s = (const char *)p; n && !error; ) {
+      const ssize_t r = ::write(fd, s, n);
+      if (r < 0 && errno == EINTR) continue;
+      if (r < 0) error = strerror(errno);
+      else s += r, n -= r, size += r;
+    }
+    return !error;
+  }
+
+  // Close, or remove a partial file after a failure. Return false on a write error.
+  bool close(bool failed) {
+    if (fd > 1 && ::close(fd) && !error) error = strerror(errno);
+    if (path && (failed || error)) unlink(path);
+    return !error;
+  }
+
+private:
+  int fd;
+  const char *path;
+};
+
+//////////////////////////// blocks ////////////////////////////
+
+struct Span {
+  size_t at, len;
+};
+
+// A block of input, from the reader to a worker, and its output, from the worker to
+// the writer.
+struct Block {
+  const char *in;  // a slice of the mapping, or buf
+  size_t len;
+  std::vector<char> buf;
+  std::vector<Span> recs;  // records to compress, in in
+  uint64_t first;          // number of the first record
+  bool open;               // the last record has no terminator
+  std::vector<char> out;
+  const char *error;       // set by the worker on failure
+  bool done;
+
+  Block(): in(NULL), len(0), first(0), open(false), error(NULL), done(false) {}
+
+  void take(Input &input, size_t n) {
+    if (input.mapped()) {
+      in = input.data();
+    } else {
+      buf.assign(input.data(), input.data() + n);
+      in = buf.data();
+    }
+    len = n;
+    input.consume(n);
+  }
+};
+
+// Each mode reads the next block, returning 1, or 0 at the end of the input, or -1
+// with input.error set; and codes a block, setting its error on failure.
+struct Mode {
+  int (*read)(Input &input, Block &b);
+  void (*code)(fpaq0f2_ctx *ctx, Block &b);
+};
+
+static int read_stream(Input &input, Block &b) {
+  const size_t n = std::min(input.fill(g_block), g_block);
+  if (input.error) return -1;
+  if (!n) return 0;
+  b.take(input, n);
+  return 1;
+}
+
+static void pack_stream(fpaq0f2_ctx *ctx, Block &b) {
+  b.out.resize(STREAM_HEADER + b.len);
+  char *const p = b.out.data();
+  size_t n = pack(ctx, b.in, b.len, p + STREAM_HEADER, b.len);
+  if (n == SIZE_MAX) {
+    b.error = "cannot compress";
+    return;
+  }
+  uint32_t flags = 0;
+  if (n >= b.len) {
+    memcpy(p + STREAM_HEADER, b.in, n = b.len);
+    flags = STORED;
+  }
+  put32(p, (uint32_t)b.len);
+  put32(p + 4, (uint32_t)n | flags);
+  put32(p + 8, fpaq0f2_crc32c(0, b.in, b.len));
+  b.out.resize(STREAM_HEADER + n);
+}
+
+static int read_packed_stream(Input &input, Block &b) {
+  if (input.fill(STREAM_HEADER) < STREAM_HEADER) {
+    if (!input.error) input.error = "truncated";
+    return -1;
+  }
+  const char *const h = input.data();
+  const size_t raw = get32(h), n = get32(h + 4) & ~STORED;
+  if (!raw) {
+    input.consume(STREAM_HEADER);
+    if (input.fill(1)) input.error = "trailing garbage";
+    return input.error ? -1 : 0;
+  }
+  if (raw > g_block || n > raw) {
+    input.error = "corrupt block header";
+    return -1;
+  }
+  if (input.fill(STREAM_HEADER + n) < STREAM_HEADER + n) {
+    if (!input.error) input.error = "truncated";
+    return -1;
+  }
+  b.take(input, STREAM_HEADER + n);
+  return 1;
+}
+
+static void unpack_stream(fpaq0f2_ctx *ctx, Block &b) {
+  const size_t raw = get32(b.in), n = get32(b.in + 4) & ~STORED;
+  const char *const payload = b.in + STREAM_HEADER;
+  b.out.resize(raw);
+  if (get32(b.in + 4) & STORED) {
+    if (n != raw) b.error = "corrupt block header";
+    else memcpy(b.out.data(), payload, n);
+  } else if (unpack(ctx, payload, n, b.out.data(), raw) != raw) {
+    b.error = "corrupt block";
+  }
+  if (!b.error && fpaq0f2_crc32c(0, b.out.data(), raw) != get32(b.in + 8)) b.error = "CRC mismatch";
+}
+
+// Find the record at off in [p, p + n): set r and *next past it and return 1, or return
+// 0 if it does not end within n bytes, or -1 if its length prefix is invalid.
+static int find_record(const char *p, size_t n, size_t off, Span &r, size_t *next) {
+  if (g_kind != LEB128) {
+    const char *const q = (const char *)memchr(p + off, g_kind == NULS ? 0 : '\n', n - off);
+    if (!q) return 0;
+    r.at = off;
+    r.len = q - p - off;
+    *next = q - p + 1;
+    return 1;
+  }
+  size_t len = 0, k = off;
+  for (int shift = 0; ; shift += 7) {
+    if (k == n) return 0;
+    if (shift > 63) return -1;
+    const uint8_t c = p[k++];
+    len |= (size_t)(c & 0x7f) << shift;
+    if (!(c & 0x80)) break;
+  }
+  if (n - k < len) return 0;
+  r.at = k;
+  r.len = len;
+  *next = k + len;
+  return 1;
+}
+
+static uint64_t g_records = 0;  // read so far, by the reader
+
+static int read_records(Input &input, Block &b) {
+  b.recs.clear();
+  b.open = false;
+  size_t off = 0;
+  for (;;) {
+    size_t n = input.fill(std::max(off + 1, g_block));
+    if (input.error) return -1;
+    if (n == off) break;
+    Span r;
+    size_t next;
+    int found;
+    while (0 == (found = find_record(input.data(), n, off, r, &next)) && input.fill(n + 1) > n)
+      n = input.fill(n + 1);
+    if (input.error) return -1;
+    if (found < 0 || (!found && g_kind == LEB128)) {
+      input.error = found < 0 ? "invalid record length" : "truncated record";
+      return -1;
+    }
+    if (!found) {
+      r.at = off;
+      r.len = n - off;
+      next = n;
+      b.open = true;
+    }
+    b.recs.push_back(r);
+    off = next;
+    if (off >= g_block) break;
+  }
+  if (b.recs.empty()) return 0;
+  b.first = g_records;
+  g_records += b.recs.size();
+  b.take(input, off);
+  return 1;
+}
+
+static void pack_records(fpaq0f2_ctx *ctx, Block &b) {
+  const size_t count = b.recs.size(), index = RECORDS_HEADER + 4 * count;
+  b.out.assign(index, 0);
+  for (size_t k = 0; k < count; ++k) {
+    const Span &r = b.recs[k];
+    if (!append(b.out, r.len + r.len / 2 + 16,
+                [&](char *out, size_t room) { return pack(ctx, b.in + r.at, r.len, out, room); })) {
+      b.error = "cannot compress";
+      return;
+    }
+    if (b.out.size() - index > UINT32_MAX) {
+      b.error = "records too long";
+      return;
+    }
+    put32(b.out.data() + RECORDS_HEADER + 4 * k, (uint32_t)(b.out.size() - index));
+  }
+  char *const p = b.out.data();
+  put32(p, (uint32_t)count);
+  put32(p + 4, b.open ? OPEN : 0);
+  put32(p + 8, (uint32_t)(b.out.size() - RECORDS_HEADER));
+  put32(p + 12, fpaq0f2_crc32c(0, p + RECORDS_HEADER, b.out.size() - RECORDS_HEADER));
+}
+
+static int read_packed_records(Input &input, Block &b) {
+  if (input.fill(RECORDS_HEADER) < RECORDS_HEADER) {
+    if (!input.error) input.error = "truncated";
+    return -1;
+  }
+  const size_t n = RECORDS_HEADER + (size_t)get32(input.data() + 8);
+  if (0 == get32(input.data())) {
+    // The table of blocks, which decompressing does not need.
+    input.consume(RECORDS_HEADER);
+    size_t m = input.fill(FOOTER);
+    while (input.fill(m + 1) > m) m = input.fill(m + 1);
+    if (!input.error && (m < FOOTER || (m - FOOTER) % 16 || memcmp(input.data() + m - 4, TABLE_MAGIC, 4)))
+      input.error = "corrupt table";
+    input.consume(m);
+    return input.error ? -1 : 0;
+  }
+  if (input.fill(n) < n) {
+    if (!input.error) input.error = "truncated";
+    return -1;
+  }
+  b.take(input, n);
+  return 1;
+}
+
+// Decompress record k of the checked block at p onto the end of out, followed by its
+// terminator, or after its length prefix. Return false on error.
+static bool unpack_record(fpaq0f2_ctx *ctx, const char *p, size_t k, std::vector<char> &out) {
+  const size_t count = get32(p), index = RECORDS_HEADER + 4 * count;
+  const size_t at = k ? get32(p + RECORDS_HEADER + 4 * (k - 1)) : 0;
+  const size_t end = get32(p + RECORDS_HEADER + 4 * k);
+  if (at > end || index + end > RECORDS_HEADER + get32(p + 8)) return false;
+  const size_t prefix = g_kind == LEB128 ? 10 : 0, start = out.size() + prefix;
+  out.resize(start);
+  if (!append(out, 4 * (end - at) + 16,
+              [&](char *o, size_t room) { return unpack(ctx, p + index + at, end - at, o, room); }))
+    return false;
+  const size_t len = out.size() - start;
+  if (g_kind == LEB128) {
+    char hdr[10];
+    size_t h = 0;
+    for (size_t v = len; ; v >>= 7) {
+      hdr[h++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+      if (v <= 0x7f) break;
+    }
+    memmove(out.data() + start - prefix + h, out.data() + start, len);
+    memcpy(out.data() + start - prefix, hdr, h);
+    out.resize(start - prefix + h + len);
+  } else if (k + 1 < count || !(get32(p + 4) & OPEN)) {
+    out.push_back(g_kind == NULS ? 0 : '\n');
+  }
+  return true;
+}
+
+static bool check_records(const char *p, size_t n) {
+  const size_t count = get32(p);
+  return n >= RECORDS_HEADER && n - RECORDS_HEADER == get32(p + 8) && count <= (n - RECORDS_HEADER) / 4 &&
+         fpaq0f2_crc32c(0, p + RECORDS_HEADER, n - RECORDS_HEADER) == get32(p + 12);
+}
+
+static void unpack_records(fpaq0f2_ctx *ctx, Block &b) {
+  b.out.clear();
+  if (!check_records(b.in, b.len)) {
+    b.error = "CRC mismatch";
+    return;
+  }
+  for (size_t k = 0, count = get32(b.in); k < count; ++k)
+    if (!unpack_record(ctx, b.in, k, b.out)) {
+      b.error = "corrupt record";
+      return;
+    }
+}
+
+static const Mode PACK_STREAM = {read_stream, pack_stream};
+static const Mode UNPACK_STREAM = {read_packed_stream, unpack_stream};
+static const Mode PACK_RECORDS = {read_records, pack_records};
+static const Mode UNPACK_RECORDS = {read_packed_records, unpack_records};
+
+//////////////////////////// pipeline ////////////////////////////
+
+// Where a block was written.
+struct Written {
+  uint64_t offset, first;
+};
+
+// A reader thread, worker threads and the calling thread as the writer, passing blocks
+// around a ring of twice as many as workers: the reader fills the next one once the
+// writer has written what it held, each worker takes the next one read, and the writer
+// waits for the next one in order to be done.
+class Pipeline {
+public:
+  std::vector<Written> written;
+
+  Pipeline(Input &input, Output &output, const Mode &mode, unsigned workers)
+      : input(input), output(output), mode(mode), workers(workers), blocks(2 * workers),
+        read_n(0), taken_n(0), written_n(0), eof(false), error(NULL) {}
+
+  // Run until the input ends, return NULL, or the first error.
+  const char *run() {
+    std::vector<std::thread> threads;
+    threads.emplace_back(&Pipeline::reader, this);
+    for (unsigned i = 0; i < workers; ++i) threads.emplace_back(&Pipeline::worker, this);
+    for (;;) {
+      Block *b;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] {
+          return error || (written_n < read_n && blocks[written_n % blocks.size()].done) ||
+                 (eof && written_n == read_n);
+        });
+        if (error || written_n == read_n) break;
+        b = &blocks[written_n % blocks.size()];
+      }
+      written.push_back(Written{output.size, b->first});
+      const bool ok = output.write(b->out.data(), b->out.size());
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!ok && !error) error = output.error;
+      b->done = false;
+      ++written_n;
+      changed.notify_all();
+    }
+    for (size_t i = 0; i < threads.size(); ++i) threads[i].join();
+    return error;
+  }
+
+private:
+  Input &input;
+  Output &output;
+  const Mode &mode;
+  const unsigned workers;
+  std::vector<Block> blocks;
+  std::mutex mutex;
+  std::condition_variable changed;
+  size_t read_n, taken_n, written_n;  // blocks read, taken by workers and written
+  bool eof;
+  const char *error;
+
+  void reader() {
+    for (size_t k = 0; ; ++k) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return error || k - written_n < blocks.size(); });
+        if (error) return;
+      }
+      Block &b = blocks[k % blocks.size()];
+      b.error = NULL;
+      const int r = mode.read(input, b);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (r < 0 && !error) error = input.error;
+      if (r == 0) eof = true;
+      if (r > 0) ++read_n;
+      changed.notify_all();
+      if (r <= 0) return;
+    }
+  }
+
+  void worker() {
+    fpaq0f2_ctx *const ctx = fpaq0f2_ctx_new();
+    for (;;) {
+      size_t k;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!ctx && !error) error = "out of memory";
+        changed.wait(lock, [&] { return error || taken_n < read_n || eof; });
+        if (error || taken_n == read_n) break;
+        k = taken_n++;
+      }
+      Block &b = blocks[k % blocks.size()];
+      mode.code(ctx, b);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (b.error && !error) error = b.error;
+      b.done = true;
+      changed.notify_all();
+    }
+    fpaq0f2_ctx_free(ctx);
+  }
+};
+
+}  // namespace
+
+//////////////////////////// main ////////////////////////////
+
+static void usage() {
+  fprintf(stderr, "usage: fss c [-b KiB] [-t threads] [-m model] input output\n"
+                  "       fss r [-z | -l] [-b KiB] [-t threads] [-m model] input output\n"
+                  "       fss d [-t threads] [-m model] input output\n"
+                  "       fss g [-m model] input index ...\n");
+  exit(2);
+}
+
+// Check the header of a compressed file against the options, and set g_kind and g_block
+// from it. Return the Mode that decompresses it, or NULL with a message.
+static const Mode *check_header(const char *h, const char *path) {
+  const uint32_t id = get32(h + 4), param = get32(h + 8);
+  const uint32_t want = g_model ? fpaq0f2_model_id(g_model) : 0;
+  const Mode *mode = NULL;
+  if (!memcmp(h, STREAM_MAGIC, 4) && param && param <= MAX_BLOCK) {
+    g_block = param;
+    mode = &UNPACK_STREAM;
+  } else if (!memcmp(h, RECORDS_MAGIC, 4) && param <= LEB128) {
+    g_kind = (Kind)param;
+    mode = &UNPACK_RECORDS;
+  } else {
+    fprintf(stderr, "%s: not compressed by fss\n", path);
+    return NULL;
+  }
+  if (id != want) {
+    if (id) fprintf(stderr, "%s: compressed with model %08x, give it by -m\n", path, id);
+    else fprintf(stderr, "%s: compressed without a model\n", path);
+    return NULL;
+  }
+  return mode;
+}
+
+// Print the records of the given numbers, found by the table of blocks.
+static int get(const char *path, char **indexes, int n) {
+  Input input;
+  if (!input.open(path)) perror(path), exit(1);
+  if (!input.mapped()) fprintf(stderr, "%s: not a regular file\n", path), exit(1);
+  const char *const p = input.data();
+  const size_t size = input.fill(SIZE_MAX);
+  if (size < FILE_HEADER + RECORDS_HEADER + FOOTER || memcmp(p + size - 4, TABLE_MAGIC, 4))
+    fprintf(stderr, "%s: not compressed records\n", path), exit(1);
+  if (!check_header(p, path)) exit(1);
+  const uint64_t table = get64(p + size - FOOTER), blocks = get64(p + size - FOOTER + 8);
+  if (table < FILE_HEADER + RECORDS_HEADER || table > size - FOOTER || (size - FOOTER - table) / 16 != blocks ||
+      (size - FOOTER - table) % 16)
+    fprintf(stderr, "%s: corrupt table\n", path), exit(1);
+
+  fpaq0f2_ctx *const ctx = fpaq0f2_ctx_new();
+  if (!ctx) fprintf(stderr, "out of memory\n"), exit(1);
+  Output output;
+  output.open("-");
+  std::vector<char> out;
+  int status = 0;
+  for (int i = 0; i < n; ++i) {
+    char *end;
+    const uint64_t r = strtoull(indexes[i], &end, 10);
+    if (end == indexes[i] || *end) usage();
+    // The last block whose first record is at most r.
+    uint64_t lo = 0, hi = blocks;
+    while (lo < hi) {
+      const uint64_t mid = lo + (hi - lo) / 2;
+      if (get64(p + table + 16 * mid + 8) <= r) lo = mid + 1;
+      else hi = mid;
+    }
+    const uint64_t at = lo ? get64(p + table + 16 * (lo - 1)) : 0;
+    const uint64_t first = lo ? get64(p + table + 16 * (lo - 1) + 8) : 0;
+    if (!lo || at < FILE_HEADER || at > table - RECORDS_HEADER ||
+        !check_records(p + at, std::min<uint64_t>(table - at, RECORDS_HEADER + get32(p + at + 8)))) {
+      fprintf(stderr, "%s: corrupt block of record %s\n", path, indexes[i]);
+      status = 1;
+      continue;
+    }
+    if (r - first >= get32(p + at)) {
+      fprintf(stderr, "%s: no record %s\n", path, indexes[i]);
+      status = 1;
+      continue;
+    }
+    out.clear();
+    if (!unpack_record(ctx, p + at, r - first, out)) {
+      fprintf(stderr, "%s: corrupt record %s\n", path, indexes[i]);
+      status = 1;
+      continue;
+    }
+    if (!output.write(out.data(), out.size())) fprintf(stderr, "-: %s\n", output.error), exit(1);
+  }
+  fpaq0f2_ctx_free(ctx);
+  return status;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || strlen(argv[1]) != 1 || !strchr("crdg", argv[1][0])) usage();
+  const char cmd = argv[1][0];
+  int i = 2;
+  for (; i < argc && argv[i][0] == '-' && argv[i][1]; ++i) {
+    const char opt = argv[i][1];
+    if (argv[i][2]) usage();
+    if (opt == 'z' && cmd == 'r') {
+      g_kind = NULS;
+    } else if (opt == 'l' && cmd == 'r') {
+      g_kind = LEB128;
+    } else if (i + 1 == argc) {
+      usage();
+    } else if (opt == 'b' && (cmd == 'c' || cmd == 'r')) {
+      const unsigned long kib = strtoul(argv[++i], NULL, 10);
+      if (kib < 1 || kib > MAX_BLOCK >> 10) usage();
+      g_block = kib << 10;
+    } else if (opt == 't' && cmd != 'g') {
+      g_threads = strtoul(argv[++i], NULL, 10);
+      if (g_threads < 1 || g_threads > 1024) usage();
+    } else if (opt == 'm') {
+      if (!(g_model = fpaq0f2_model_load_file(argv[++i])))
+        fprintf(stderr, "%s: not a readable model file\n", argv[i]), exit(1);
+    } else {
+      usage();
+    }
+  }
+  if (cmd == 'g') {
+    if (argc - i < 2) usage();
+    return get(argv[i], argv + i + 1, argc - i - 1);
+  }
+  if (argc - i != 2) usage();
+  const char *const in_path = argv[i], *const out_path = argv[i + 1];
+  if (!g_threads) g_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  Input input;
+  if (!input.open(in_path)) perror(in_path), exit(1);
+  Output output;
+  if (!output.open(out_path)) perror(out_path), exit(1);
+
+  char header[FILE_HEADER];
+  const Mode *mode;
+  if (cmd == 'd') {
+    if (input.fill(FILE_HEADER) < FILE_HEADER) {
+      fprintf(stderr, "%s: %s\n", in_path, input.error ? input.error : "not compressed by fss");
+      output.close(true);
+      return 1;
+    }
+    if (!(mode = check_header(input.data(), in_path))) {
+      output.close(true);
+      return 1;
+    }
+    input.consume(FILE_HEADER);
+  } else {
+    memcpy(header, cmd == 'c' ? STREAM_MAGIC : RECORDS_MAGIC, 4);
+    put32(header + 4, g_model ? fpaq0f2_model_id(g_model) : 0);
+    put32(header + 8, cmd == 'c' ? (uint32_t)g_block : (uint32_t)g_kind);
+    output.write(header, FILE_HEADER);
+    mode = cmd == 'c' ? &PACK_STREAM : &PACK_RECORDS;
+  }
+
+  Pipeline pipeline(input, output, *mode, g_threads);
+  const char *error = pipeline.run();
+  if (!error && cmd != 'd') {
+    std::vector<char> tail(cmd == 'c' ? STREAM_HEADER : RECORDS_HEADER, 0);
+    if (cmd == 'r') {
+      const uint64_t table = output.size + RECORDS_HEADER;
+      for (size_t k = 0; k < pipeline.written.size(); ++k) {
+        tail.resize(tail.size() + 16);
+        put64(tail.data() + tail.size() - 16, pipeline.written[k].offset);
+        put64(tail.data() + tail.size() - 8, pipeline.written[k].first);
+      }
+      tail.resize(tail.size() + FOOTER);
+      put64(tail.data() + tail.size() - FOOTER, table);
+      put64(tail.data() + tail.size() - FOOTER + 8, pipeline.written.size());
+      memcpy(tail.data() + tail.size() - 4, TABLE_MAGIC, 4);
+    }
+    output.write(tail.data(), tail.size());
+  }
+  if (!error && output.error) error = output.error;
+  const bool closed = output.close(error != NULL);
+  if (error || !closed) {
+    fprintf(stderr, "%s: %s\n", error && error != output.error ? in_path : out_path, error ? error : output.error);
+    return 1;
+  }
+  fprintf(stderr, "%s (%llu bytes) -> %s (%llu bytes) in %1.2f s.\n", in_path,
+          (unsigned long long)input.size, out_path,
+          (unsigned long long)output.size,
+          std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  fpaq0f2_model_free(g_model);
+  return 0;
+}
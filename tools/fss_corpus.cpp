@@ -0,0 +1,100 @@
+/* fss_corpus - write a reproducible synthetic corpus of short strings.
+
+To compile: g++ -O2 -std=c++17 -I../bench fss_corpus.cpp
+To run:     fss_corpus [options] kind output
+            kind is one of urls, emails, paths, json_keys, words, logs, ids, cache_keys
+  -n count      strings to write (default 100000)
+  -s seed       generator seed (default 1)
+  -H hosts      distinct hostnames (default 1000)
+  -z exponent   Zipf exponent of hostnames and words (default 1.1)
+  -d depth      most path segments (default 6)
+  -i format     id format: uuid, hex, decimal or base64 (default uuid)
+  -u per_mille  words drawn from non-ASCII scripts, per 1000 (default 0)
+  -l histogram  lengths as max_len:weight,... by increasing max_len, such as
+                8:20,16:50,64:30 (default: the natural lengths of the kind)
+
+The output is in the length-prefixed format of bench/corpus.h, which
+fss_bench and fss_train read. The same options write the same file on
+every machine.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "corpus.h"
+
+static void usage() {
+  fprintf(stderr, "usage: fss_corpus [-n count] [-s seed] [-H hosts] [-z exponent] [-d depth]\n"
+                  "                  [-i format] [-u per_mille] [-l histogram] kind output\n");
+  exit(2);
+}
+
+// Parse max_len:weight,... into lengths, return false if malformed.
+static bool parse_lengths(const char *s, std::vector<fss::LengthBucket> &lengths) {
+  while (*s) {
+    char *end;
+    fss::LengthBucket b;
+    b.max_len = strtoul(s, &end, 10);
+    if (end == s || *end != ':') return false;
+    s = end + 1;
+    b.weight = strtoul(s, &end, 10);
+    if (end == s || (*end && *end != ',')) return false;
+    if (!lengths.empty() && b.max_len <= lengths.back().max_len) return false;
+    lengths.push_back(b);
+    s = *end ? end + 1 : end;
+  }
+  return !lengths.empty();
+}
+
+template <size_t N>
+static int lookup(const char *const (&names)[N], const char *s) {
+  for (size_t k = 0; k < N; ++k)
+    if (!strcmp(names[k], s)) return (int)k;
+  return -1;
+}
+
+int main(int argc, char **argv) {
+  fss::Config cfg;
+  size_t count = 100000;
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    const char *v = argv[i + 1];
+    switch (argv[i][1]) {
+    case 'n': count = strtoul(v, NULL, 10); break;
+    case 's': cfg.seed = strtoull(v, NULL, 10); break;
+    case 'H': cfg.hosts = strtoul(v, NULL, 10); break;
+    case 'z': cfg.host_zipf = atof(v); break;
+    case 'd': cfg.max_depth = atoi(v); break;
+    case 'u': cfg.utf8_per_mille = atoi(v); break;
+    case 'i': {
+      const int f = lookup(fss::id_format_names, v);
+      if (f < 0) usage();
+      cfg.id_format = (fss::IdFormat)f;
+      break;
+    }
+    case 'l':
+      if (!parse_lengths(v, cfg.lengths)) usage();
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - i != 2) usage();
+  const int kind = lookup(fss::kind_names, argv[i]);
+  if (kind < 0 || cfg.host_zipf < 0 || cfg.utf8_per_mille > 1000) usage();
+  cfg.kind = (fss::Kind)kind;
+
+  fss::Generator gen(cfg);
+  std::vector<std::string> strs;
+  strs.reserve(count);
+  for (size_t k = 0; k < count; ++k) strs.push_back(gen.next());
+
+  FILE *f = fopen(argv[i + 1], "wb");
+  if (!f) perror(argv[i + 1]), exit(1);
+  if (!fss::write_corpus(f, strs) || fclose(f)) perror(argv[i + 1]), exit(1);
+  return 0;
+}
@@ -0,0 +1,73 @@
+/* fss_train - train a frozen fpaq0f2 model on corpus files.
+
+To compile: g++ -O2 -std=c++17 -I../bench -I../ext/fpaq0f2 fss_train.cpp ../ext/fpaq0f2/fpaq0f2.cpp
+To run:     fss_train [-t kinds] model corpus ...
+
+Trains on every string of the corpus files, in the length-prefixed format
+of bench/corpus.h, and saves the model by fpaq0f2_model_save(). With -t,
+the samples are first tokenized with the FPAQ0F2_TOKEN_* kinds given as a
+number, for fpaq0f2_token_compress(). Prints the model id, and the
+compression ratio of the corpus under the new model.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "corpus.h"
+#include "fpaq0f2.h"
+
+int main(int argc, char **argv) {
+  int kinds = 0;
+  int i = 1;
+  if (i + 1 < argc && !strcmp(argv[i], "-t")) {
+    kinds = atoi(argv[i + 1]);
+    i += 2;
+  }
+  if (argc - i < 2 || kinds < 0 || kinds > FPAQ0F2_TOKEN_ALL) {
+    fprintf(stderr, "usage: fss_train [-t kinds] model corpus ...\n");
+    return 2;
+  }
+  const char *model_path = argv[i++];
+
+  std::vector<std::string> strs;
+  for (; i < argc; ++i)
+    if (!fss::read_corpus(argv[i], strs)) fprintf(stderr, "%s: not a corpus\n", argv[i]), exit(1);
+
+  std::string samples;
+  std::vector<size_t> lens;
+  size_t raw = 0;
+  for (size_t k = 0; k < strs.size(); ++k) {
+    raw += strs[k].size();
+    if (kinds) {
+      std::vector<char> t(2 * strs[k].size());
+      const size_t n = fpaq0f2_tokenize(strs[k].data(), strs[k].size(), t.data(), t.size(), kinds);
+      strs[k].assign(t.data(), n);
+    }
+    samples += strs[k];
+    lens.push_back(strs[k].size());
+  }
+
+  fpaq0f2_model *m = fpaq0f2_model_train(samples.data(), lens.data(), lens.size());
+  if (!m) fprintf(stderr, "out of memory\n"), exit(1);
+
+  std::vector<char> buf(FPAQ0F2_MODEL_SIZE);
+  if (fpaq0f2_model_save(m, buf.data(), buf.size()) != buf.size())
+    fprintf(stderr, "%s: fpaq0f2_model_save failed\n", model_path), exit(1);
+  FILE *f = fopen(model_path, "wb");
+  if (!f) perror(model_path), exit(1);
+  if (fwrite(buf.data(), 1, buf.size(), f) != buf.size() || fclose(f)) perror(model_path), exit(1);
+
+  size_t packed = 0;
+  for (size_t k = 0; k < strs.size(); ++k) {
+    std::vector<char> out(4 * strs[k].size() + 16);
+    packed += fpaq0f2_model_compress(m, strs[k].data(), strs[k].size(), out.data(), out.size());
+  }
+  printf("%zu strings, %zu bytes, model id %08x, ratio %.3f\n", strs.size(), raw,
+         fpaq0f2_model_id(m), raw ? (double)packed / raw : 0.0);
+  fpaq0f2_model_free(m);
+  return 0;
+}